@@ -0,0 +1,197 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: AllocationCounter.cpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "AllocationCounter.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+// Replacements of the global operator new and delete that count every allocation, and with glibc, of malloc
+// and its relatives as well, so that the allocations of Eigen (which uses malloc) and of C libraries are
+// counted too. They have to be defined in exactly one translation unit, which is why this is not a header.
+
+// glibc lets a program replace malloc, and exports its own implementation as __libc_malloc etc.:
+#if defined(__GLIBC__)
+#define EOSVIEWER_COUNT_MALLOC 1
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t num, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+void __libc_free(void* ptr);
+}
+#else
+#define EOSVIEWER_COUNT_MALLOC 0
+#endif
+
+namespace {
+
+std::atomic<std::uint64_t> num_allocations{0};
+std::atomic<std::uint64_t> num_bytes{0};
+
+void count_allocation(std::size_t size) noexcept
+{
+    num_allocations.fetch_add(1, std::memory_order_relaxed);
+    num_bytes.fetch_add(size, std::memory_order_relaxed);
+};
+
+void* counted_malloc(std::size_t size) noexcept
+{
+#if !EOSVIEWER_COUNT_MALLOC
+    // Otherwise, malloc counts it:
+    count_allocation(size);
+#endif
+    return std::malloc(size == 0 ? 1 : size);
+};
+
+void* counted_new(std::size_t size)
+{
+    while (true)
+    {
+        void* ptr = counted_malloc(size);
+        if (ptr)
+        {
+            return ptr;
+        }
+        const auto handler = std::get_new_handler();
+        if (!handler)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+};
+
+} /* unnamed namespace */
+
+#if EOSVIEWER_COUNT_MALLOC
+extern "C" {
+
+void* malloc(std::size_t size) noexcept
+{
+    count_allocation(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t num, std::size_t size) noexcept
+{
+    count_allocation(num * size);
+    return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, std::size_t size) noexcept
+{
+    count_allocation(size);
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(std::size_t alignment, std::size_t size) noexcept
+{
+    count_allocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(std::size_t alignment, std::size_t size) noexcept
+{
+    count_allocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, std::size_t alignment, std::size_t size) noexcept
+{
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+    {
+        return EINVAL;
+    }
+    count_allocation(size);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr || size == 0 ? 0 : ENOMEM;
+}
+
+void free(void* ptr) noexcept
+{
+    __libc_free(ptr);
+}
+
+} /* extern "C" */
+#endif
+
+namespace eosviewer {
+
+AllocationStats get_allocation_stats()
+{
+    AllocationStats stats;
+    stats.num_allocations = num_allocations.load(std::memory_order_relaxed);
+    stats.num_bytes = num_bytes.load(std::memory_order_relaxed);
+    return stats;
+};
+
+} /* namespace eosviewer */
+
+void* operator new(std::size_t size)
+{
+    return counted_new(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return counted_new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_malloc(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_malloc(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    std::free(ptr);
+}
@@ -0,0 +1,61 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: AllocationCounter.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_ALLOCATIONCOUNTER_HPP
+#define EOSVIEWER_ALLOCATIONCOUNTER_HPP
+
+#include <cstdint>
+
+namespace eosviewer {
+
+/**
+ * Number of heap allocations and allocated bytes, as counted by the instrumented global
+ * operator new in AllocationCounter.cpp, and with glibc, by the instrumented malloc, calloc,
+ * realloc and aligned allocation functions. Without glibc, allocations that don't go through
+ * operator new are not counted: those of Eigen's matrices (including temporaries like the
+ * results of cast<>()), which Eigen allocates with malloc, and e.g. ImGui's.
+ */
+struct AllocationStats
+{
+    std::uint64_t num_allocations = 0;
+    std::uint64_t num_bytes = 0;
+};
+
+/**
+ * Returns the total number of allocations and bytes since the start of the program.
+ * Take the difference of two calls to get the numbers for a frame.
+ *
+ * Thread-safe. Counting uses relaxed atomics and is always on, so the overhead is one
+ * atomic increment per allocation.
+ */
+AllocationStats get_allocation_stats();
+
+inline AllocationStats operator-(const AllocationStats& lhs, const AllocationStats& rhs)
+{
+    AllocationStats difference;
+    difference.num_allocations = lhs.num_allocations - rhs.num_allocations;
+    difference.num_bytes = lhs.num_bytes - rhs.num_bytes;
+    return difference;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_ALLOCATIONCOUNTER_HPP */
@@ -0,0 +1,366 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: AsyncModelEvaluator.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_ASYNCMODELEVALUATOR_HPP
+#define EOSVIEWER_ASYNCMODELEVALUATOR_HPP
+
+#include "LoadedModel.hpp"
+#include "ModelEvaluator.hpp"
+#include "StageProfiler.hpp"
+#include "ThreadPool.hpp"
+
+#include "Eigen/Core"
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * Evaluates a model on a dedicated thread, so that the UI stays responsive while a large model is
+ * evaluated, e.g. while a slider is dragged.
+ *
+ * The UI thread marks the parts whose coefficients have changed (like with ModelEvaluator), and posts
+ * the coefficients with request_update() once per frame. The evaluation thread evaluates the latest
+ * request with a ModelEvaluator, so only the changed parts, and incrementally. Requests that are posted
+ * while it is busy replace each other, so the ones in between are never evaluated (latest wins).
+ *
+ * The results are double-buffered: the evaluation thread writes into one of two buffers, and then
+ * makes it the ready one. The UI thread takes the ready buffer with take_latest(), which only locks
+ * for as long as it copies the instances, and the evaluation thread meanwhile writes into the other
+ * buffer. Each part of a buffer has a version, so that only the parts that are outdated are copied into
+ * it, and take_latest() reports which parts have changed since the previous result it took.
+ *
+ * All member functions have to be called from the same (UI) thread.
+ */
+class AsyncModelEvaluator
+{
+public:
+    /**
+     * Starts the evaluation thread.
+     *
+     * @param[in] result_ready If given, called on the evaluation thread whenever a new result is ready,
+     *                         e.g. to wake up a UI that only redraws on events. It must be thread-safe.
+     */
+    explicit AsyncModelEvaluator(std::function<void()> result_ready = nullptr)
+        : result_ready(std::move(result_ready)), worker([this]() { run(); }){};
+
+    /**
+     * Stops the evaluation thread, see stop().
+     */
+    ~AsyncModelEvaluator()
+    {
+        stop();
+    };
+
+    AsyncModelEvaluator(const AsyncModelEvaluator&) = delete;
+    AsyncModelEvaluator& operator=(const AsyncModelEvaluator&) = delete;
+
+    /**
+     * Waits for the current evaluation to finish, and stops the evaluation thread. Afterwards,
+     * result_ready is not called anymore, so this has to be called before whatever it uses is shut
+     * down. Requests that are posted afterwards are not evaluated. Calling it again does nothing.
+     */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        request_posted.notify_one();
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    };
+
+    /**
+     * Sets the model to evaluate. The model's storage is shared with the evaluation thread, so the
+     * caller can release or replace its own copy at any time. Results of the previous model that
+     * haven't been taken yet, or are still being evaluated, are dropped. Marks all parts as dirty.
+     *
+     * @param[in] model The model to evaluate.
+     */
+    void set_model(const LoadedModel& model)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            request.model = model;
+            request.model_changed = true;
+            ++model_generation;
+            has_result = false;
+        }
+        mark_all_dirty();
+    };
+
+    /**
+     * Sets a thread pool for the evaluation thread to evaluate the model on. It must not be used by
+     * another thread for anything that waits for the evaluation.
+     */
+    void set_thread_pool(ThreadPool* thread_pool)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        request.thread_pool = thread_pool;
+    };
+
+    /**
+     * Sets a profiler to record the time of each evaluation in, as the given stage, or nullptr to not
+     * record them.
+     */
+    void set_profiler(StageProfiler* profiler, int stage)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        request.profiler = profiler;
+        request.profiler_stage = stage;
+    };
+
+    void mark_dirty(ModelPart part)
+    {
+        dirty[static_cast<std::size_t>(part)] = true;
+    };
+
+    void mark_all_dirty()
+    {
+        dirty.fill(true);
+    };
+
+    bool is_dirty(ModelPart part) const
+    {
+        return dirty[static_cast<std::size_t>(part)];
+    };
+
+    /**
+     * Posts the given coefficients for evaluation, if any part has been marked dirty since the last
+     * request, and returns right away. A request that the evaluation thread hasn't started on yet is
+     * replaced; its dirty parts are kept. Does not allocate, once the coefficients have had their size.
+     *
+     * @param[in] shape_coefficients Coefficients of the shape PCA model.
+     * @param[in] expression_coefficients Coefficients of the expression PCA model or blendshapes.
+     * @param[in] color_coefficients Coefficients of the colour PCA model.
+     * @param[in] use_expressions Whether to add the expression part to the shape.
+     */
+    void request_update(const std::vector<float>& shape_coefficients,
+                        const std::vector<float>& expression_coefficients,
+                        const std::vector<float>& color_coefficients, bool use_expressions)
+    {
+        if (!dirty[0] && !dirty[1] && !dirty[2])
+        {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            request.shape_coefficients.assign(begin(shape_coefficients), end(shape_coefficients));
+            request.expression_coefficients.assign(begin(expression_coefficients),
+                                                   end(expression_coefficients));
+            request.color_coefficients.assign(begin(color_coefficients), end(color_coefficients));
+            request.use_expressions = use_expressions;
+            for (std::size_t i = 0; i < dirty.size(); ++i)
+            {
+                request.dirty[i] = request.dirty[i] || dirty[i];
+            }
+            has_request = true;
+        }
+        dirty.fill(false);
+        request_posted.notify_one();
+    };
+
+    /**
+     * If a result has been completed since the last call, calls take with its instances, while the
+     * evaluation thread can't replace them. take should only copy them.
+     *
+     * @param[in] take A callable taking the shape instance, the colour instance (as const
+     *                 Eigen::VectorXf&) and an UpdateResult with the instances that have changed since
+     *                 the previous result that has been taken.
+     * @return Whether there was a new result.
+     */
+    template <class Take>
+    bool take_latest(Take&& take)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!has_result)
+        {
+            return false;
+        }
+        has_result = false;
+        const auto& ready = buffers[ready_buffer];
+        UpdateResult update;
+        update.vertices_changed = ready.shape_version != taken_shape_version;
+        update.colors_changed = ready.color_version != taken_color_version;
+        taken_shape_version = ready.shape_version;
+        taken_color_version = ready.color_version;
+        take(ready.shape_instance, ready.color_instance, update);
+        return true;
+    };
+
+    /**
+     * Whether a request is waiting or being evaluated.
+     */
+    bool is_busy() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return has_request || evaluating;
+    };
+
+private:
+    // The latest request of the UI thread, which the evaluation thread hasn't taken yet:
+    struct Request
+    {
+        LoadedModel model;
+        bool model_changed = false;
+        ThreadPool* thread_pool = nullptr;
+        StageProfiler* profiler = nullptr;
+        int profiler_stage = 0;
+        std::vector<float> shape_coefficients;
+        std::vector<float> expression_coefficients;
+        std::vector<float> color_coefficients;
+        bool use_expressions = false;
+        std::array<bool, 3> dirty{{false, false, false}}; // shp, exp, col
+    };
+
+    // A result. The version of a part is increased whenever the evaluation changes it:
+    struct Buffer
+    {
+        Eigen::VectorXf shape_instance;
+        Eigen::VectorXf color_instance;
+        std::uint64_t shape_version = 0;
+        std::uint64_t color_version = 0;
+    };
+
+    // Used by the UI thread only:
+    std::array<bool, 3> dirty{{true, true, true}};
+    std::uint64_t taken_shape_version = 0;
+    std::uint64_t taken_color_version = 0;
+
+    // Shared, guarded by the mutex:
+    mutable std::mutex mutex;
+    std::condition_variable request_posted;
+    Request request;
+    bool has_request = false;
+    bool evaluating = false;
+    bool stopping = false;
+    std::uint64_t model_generation = 0; // increased by set_model(), to drop the results of older models
+    std::array<Buffer, 2> buffers;
+    int ready_buffer = 0; // the evaluation thread writes into the other one
+    bool has_result = false;
+
+    const std::function<void()> result_ready;
+    std::thread worker; // last, so that it starts after everything else has been initialised
+
+    void run()
+    {
+        trace::set_thread_name("model evaluation");
+        ModelEvaluator evaluator;
+        LoadedModel model; // keeps the storage alive while it's evaluated
+        std::vector<float> shape_coefficients, expression_coefficients, color_coefficients;
+        std::uint64_t shape_version = 0;
+        std::uint64_t color_version = 0;
+        while (true)
+        {
+            bool use_expressions;
+            std::uint64_t generation;
+            StageProfiler* profiler;
+            int profiler_stage;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                request_posted.wait(lock, [this]() { return stopping || has_request; });
+                if (stopping)
+                {
+                    return;
+                }
+                if (request.model_changed)
+                {
+                    model = std::move(request.model);
+                    request.model = LoadedModel();
+                    request.model_changed = false;
+                    evaluator.set_model(model.view);
+                }
+                evaluator.set_thread_pool(request.thread_pool);
+                profiler = request.profiler;
+                profiler_stage = request.profiler_stage;
+                // Swapping hands the request our previous coefficients, so that neither side allocates:
+                shape_coefficients.swap(request.shape_coefficients);
+                expression_coefficients.swap(request.expression_coefficients);
+                color_coefficients.swap(request.color_coefficients);
+                use_expressions = request.use_expressions;
+                for (const auto part : {ModelPart::Shape, ModelPart::Expression, ModelPart::Color})
+                {
+                    if (request.dirty[static_cast<std::size_t>(part)])
+                    {
+                        evaluator.mark_dirty(part);
+                    }
+                }
+                request.dirty.fill(false);
+                has_request = false;
+                evaluating = true;
+                generation = model_generation;
+            }
+
+            const auto evaluation_start = StageProfiler::clock::now();
+            const auto update = evaluator.update(shape_coefficients, expression_coefficients,
+                                                 color_coefficients, use_expressions);
+            if (profiler)
+            {
+                profiler->record(profiler_stage, evaluation_start, StageProfiler::clock::now());
+            }
+            shape_version += update.vertices_changed ? 1 : 0;
+            color_version += update.colors_changed ? 1 : 0;
+            // The UI thread only reads the ready buffer, so the other one can be written without the lock:
+            auto& buffer = buffers[1 - ready_buffer];
+            if (buffer.shape_version != shape_version)
+            {
+                buffer.shape_instance = evaluator.get_shape_instance();
+                buffer.shape_version = shape_version;
+            }
+            if (buffer.color_version != color_version)
+            {
+                buffer.color_instance = evaluator.get_color_instance();
+                buffer.color_version = color_version;
+            }
+
+            bool published = false;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                evaluating = false;
+                if (generation == model_generation && (update.vertices_changed || update.colors_changed))
+                {
+                    ready_buffer = 1 - ready_buffer;
+                    has_result = true;
+                    published = true;
+                }
+            }
+            if (published && result_ready)
+            {
+                result_ready();
+            }
+        }
+    };
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_ASYNCMODELEVALUATOR_HPP */
@@ -0,0 +1,153 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: AsyncModelLoader.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_ASYNCMODELLOADER_HPP
+#define EOSVIEWER_ASYNCMODELLOADER_HPP
+
+#include "LoadedModel.hpp"
+#include "LoadProgress.hpp"
+#include "trace.hpp"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace eosviewer {
+
+/**
+ * Loads a model on a background thread, so that the viewer keeps rendering (the previous model)
+ * while a model is being loaded.
+ *
+ * The UI thread starts a load with start(), and calls poll() once per frame, between frames. When
+ * the load has finished, poll() hands over the new model, which the UI thread then swaps in as a
+ * whole. The loading thread never touches the viewer's model, so no locking is needed.
+ *
+ * Only one load runs at a time. All member functions have to be called from the same thread.
+ */
+class AsyncModelLoader
+{
+public:
+    using LoadFunction = std::function<LoadedModel(LoadProgress&)>;
+
+    AsyncModelLoader() = default;
+
+    /**
+     * Waits for a running load to finish (and discards its result).
+     */
+    ~AsyncModelLoader()
+    {
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    };
+
+    AsyncModelLoader(const AsyncModelLoader&) = delete;
+    AsyncModelLoader& operator=(const AsyncModelLoader&) = delete;
+
+    /**
+     * Starts loading a model on a background thread, unless a load is already in progress.
+     *
+     * @param[in] load The function that loads the model. It is run on the loading thread, so it must
+     *                 not access anything that the UI thread modifies. It should report its progress
+     *                 in the given LoadProgress, and may throw to report an error.
+     * @return Whether the load has been started.
+     */
+    bool start(LoadFunction load)
+    {
+        if (is_loading())
+        {
+            return false;
+        }
+        progress.reset();
+        finished = false;
+        loaded_model = LoadedModel();
+        error_message.clear();
+        worker = std::thread([this, load]() {
+            trace::set_thread_name("model loading");
+            try
+            {
+                loaded_model = load(progress);
+            } catch (const std::exception& e)
+            {
+                error_message = e.what();
+            } catch (...)
+            {
+                error_message = "Unknown error.";
+            }
+            finished.store(true, std::memory_order_release);
+        });
+        return true;
+    };
+
+    /**
+     * Whether a load is in progress, or has finished but not yet been handed over by poll().
+     */
+    bool is_loading() const
+    {
+        return worker.joinable();
+    };
+
+    /**
+     * The progress of the current load. It can be read while the load is in progress.
+     */
+    const LoadProgress& get_progress() const
+    {
+        return progress;
+    };
+
+    /**
+     * Checks whether the current load has finished, without blocking. If it has, the result is
+     * handed over: either the model, or, if the load failed, an error message.
+     *
+     * @param[out] model The loaded model, if the load has finished successfully.
+     * @param[out] error The error message, if the load has failed. Empty otherwise.
+     * @return Whether a load has finished (successfully or not) since the last call.
+     */
+    bool poll(LoadedModel& model, std::string& error)
+    {
+        if (!worker.joinable() || !finished.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        worker.join();
+        model = std::move(loaded_model);
+        loaded_model = LoadedModel();
+        error = std::move(error_message);
+        error_message.clear();
+        return true;
+    };
+
+private:
+    std::thread worker;
+    LoadProgress progress;
+    std::atomic<bool> finished{false};
+    // Written by the loading thread, and only read after finished has been set:
+    LoadedModel loaded_model;
+    std::string error_message;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_ASYNCMODELLOADER_HPP */
@@ -0,0 +1,188 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: BasisView.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_BASISVIEW_HPP
+#define EOSVIEWER_BASISVIEW_HPP
+
+#include "half_float.hpp"
+
+#include "Eigen/Core"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace eosviewer {
+
+/**
+ * The precision that a basis (a PCA basis, or the packed blendshapes) is stored in.
+ *
+ * Float16 is IEEE 754 half precision. Int8 stores each column as signed 8-bit integers in [-127, 127],
+ * with one float scale per column, so that an element is its integer times the scale of its column.
+ */
+enum class BasisPrecision { Float32, Float16, Int8 };
+
+inline const char* to_string(BasisPrecision precision)
+{
+    switch (precision)
+    {
+    case BasisPrecision::Float16:
+        return "fp16";
+    case BasisPrecision::Int8:
+        return "int8";
+    default:
+        return "fp32";
+    }
+};
+
+/**
+ * Parses "fp32", "fp16" or "int8".
+ *
+ * @return Whether the string is one of those.
+ */
+inline bool from_string(const std::string& string, BasisPrecision& precision)
+{
+    for (const auto candidate : {BasisPrecision::Float32, BasisPrecision::Float16, BasisPrecision::Int8})
+    {
+        if (string == to_string(candidate))
+        {
+            precision = candidate;
+            return true;
+        }
+    }
+    return false;
+};
+
+/**
+ * Returns the size of one element of a basis stored in the given precision, in bytes.
+ */
+inline std::size_t get_element_size(BasisPrecision precision)
+{
+    switch (precision)
+    {
+    case BasisPrecision::Float16:
+        return sizeof(std::uint16_t);
+    case BasisPrecision::Int8:
+        return sizeof(std::int8_t);
+    default:
+        return sizeof(float);
+    }
+};
+
+/**
+ * A non-owning view on a column-major rows x cols basis, in any BasisPrecision. The evaluation kernels
+ * (see tiled_kernels.hpp) take a BasisView, and dequantize it on the fly.
+ */
+struct BasisView
+{
+    const void* data = nullptr;
+    const float* column_scales = nullptr; // one per column, if the precision is Int8
+    BasisPrecision precision = BasisPrecision::Float32;
+    int rows = 0;
+    int cols = 0;
+
+    /**
+     * Returns a pointer to the first element of the given column.
+     */
+    const void* get_column(int col) const
+    {
+        return static_cast<const unsigned char*>(data) +
+               static_cast<std::size_t>(col) * rows * get_element_size(precision);
+    };
+
+    /**
+     * Returns the element in the given row and column, dequantized.
+     */
+    float get_element(int row, int col) const
+    {
+        const std::size_t index = static_cast<std::size_t>(col) * rows + row;
+        switch (precision)
+        {
+        case BasisPrecision::Float16:
+            return half_to_float(static_cast<const std::uint16_t*>(data)[index]);
+        case BasisPrecision::Int8:
+            return static_cast<const std::int8_t*>(data)[index] * column_scales[col];
+        default:
+            return static_cast<const float*>(data)[index];
+        }
+    };
+
+    /**
+     * Returns the basis as Eigen matrix. Only valid if the precision is Float32.
+     */
+    Eigen::Map<const Eigen::MatrixXf> get_float_matrix() const
+    {
+        return Eigen::Map<const Eigen::MatrixXf>(static_cast<const float*>(data), rows, cols);
+    };
+
+    std::size_t get_size_in_bytes() const
+    {
+        return static_cast<std::size_t>(rows) * cols * get_element_size(precision) +
+               (precision == BasisPrecision::Int8 ? cols * sizeof(float) : 0);
+    };
+};
+
+/**
+ * A contiguous range of rows of a column of a SparseBasisView, whose values are stored at
+ * values[value_offset], ..., values[value_offset + num_rows - 1].
+ */
+struct RowBlock
+{
+    int first_row;
+    int num_rows;
+    std::ptrdiff_t value_offset;
+};
+
+/**
+ * A non-owning view on a sparse, column-major rows x cols float basis, in which each column only stores
+ * the blocks of rows that are non-zero. The blocks of column k are blocks[column_blocks[k]], ...,
+ * blocks[column_blocks[k + 1] - 1], sorted by their first row, and they don't overlap. The values of
+ * the blocks of all columns are stored one after the other, in that order.
+ *
+ * The evaluation kernels (see tiled_kernels.hpp) only read and add the stored values, so their cost
+ * scales with the number of non-zero rows and not with the number of rows. See SparseBlendshapes.hpp.
+ */
+struct SparseBasisView
+{
+    const RowBlock* blocks = nullptr;
+    const int* column_blocks = nullptr; // cols + 1 entries
+    const float* values = nullptr;
+    int rows = 0;
+    int cols = 0;
+
+    bool empty() const
+    {
+        return blocks == nullptr;
+    };
+
+    /**
+     * Returns the number of values that are stored for the first num_cols columns.
+     */
+    std::ptrdiff_t get_num_values(int num_cols) const
+    {
+        const int last_block = column_blocks[num_cols] - 1;
+        return last_block < 0 ? 0 : blocks[last_block].value_offset + blocks[last_block].num_rows;
+    };
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_BASISVIEW_HPP */
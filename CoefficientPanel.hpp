@@ -0,0 +1,125 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: CoefficientPanel.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_COEFFICIENTPANEL_HPP
+#define EOSVIEWER_COEFFICIENTPANEL_HPP
+
+#include "FrameArena.hpp"
+
+#include "imgui/imgui.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * The sliders of one set of coefficients (shape, colour or expression), for any number of them.
+ *
+ * The sliders are in a scrolling region, and only the rows that are visible are submitted to ImGui
+ * (with ImGuiListClipper), and only these get a label. So the cost per frame depends on the height of
+ * the window, and not on the number of coefficients, and models with hundreds of components can show
+ * all of them. Above the sliders, "Go to" scrolls to a coefficient, and "Non-zero only" filters the
+ * sliders down to the coefficients that aren't zero.
+ */
+class CoefficientPanel
+{
+public:
+    /**
+     * Draws the panel into the current window, below what's been drawn into it so far.
+     *
+     * @param[in,out] coefficients The coefficients, one slider each.
+     * @param[in] min_value The lower end of the sliders.
+     * @param[in] max_value The upper end of the sliders.
+     * @param[in] frame_arena The arena to format the labels of the visible sliders into.
+     * @return Whether a coefficient has been changed.
+     */
+    bool draw(std::vector<float>& coefficients, float min_value, float max_value, FrameArena& frame_arena)
+    {
+        const int num_coefficients = static_cast<int>(coefficients.size());
+        ImGui::Text("Coefficients: %d", num_coefficients);
+        if (num_coefficients == 0)
+        {
+            return false;
+        }
+        if (ImGui::InputInt("Go to", &go_to_index, 1, 10, ImGuiInputTextFlags_EnterReturnsTrue))
+        {
+            go_to_index = std::max(0, std::min(go_to_index, num_coefficients - 1));
+            scroll_to_index = go_to_index;
+            non_zero_only = false; // the coefficient might be zero
+        }
+        ImGui::Checkbox("Non-zero only", &non_zero_only);
+
+        // The rows that are shown: all coefficients, or the non-zero ones. The slider that is being dragged
+        // stays, even if it's dragged through zero:
+        rows.clear();
+        if (non_zero_only)
+        {
+            for (int i = 0; i < num_coefficients; ++i)
+            {
+                if (coefficients[i] != 0.0f || i == active_index)
+                {
+                    rows.push_back(i);
+                }
+            }
+        }
+        const int num_rows = non_zero_only ? static_cast<int>(rows.size()) : num_coefficients;
+
+        bool changed = false;
+        ImGui::BeginChild("Sliders");
+        const float row_height = ImGui::GetFrameHeightWithSpacing();
+        if (scroll_to_index >= 0)
+        {
+            ImGui::SetScrollY(scroll_to_index * row_height);
+            scroll_to_index = -1;
+        }
+        active_index = -1;
+        ImGuiListClipper clipper(num_rows, row_height);
+        while (clipper.Step())
+        {
+            for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; ++row)
+            {
+                const int i = non_zero_only ? rows[row] : row;
+                if (ImGui::SliderFloat(frame_arena.format("%d", i), &coefficients[i], min_value, max_value))
+                {
+                    changed = true;
+                }
+                if (ImGui::IsItemActive())
+                {
+                    active_index = i;
+                }
+            }
+        }
+        ImGui::EndChild();
+        return changed;
+    };
+
+private:
+    int go_to_index = 0;
+    int scroll_to_index = -1; // the coefficient to scroll to in the next frame, if any
+    bool non_zero_only = false;
+    int active_index = -1; // the coefficient whose slider is being dragged, if any
+    std::vector<int> rows; // kept, so that filtering doesn't allocate each frame
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_COEFFICIENTPANEL_HPP */
@@ -0,0 +1,106 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: FrameArena.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_FRAMEARENA_HPP
+#define EOSVIEWER_FRAMEARENA_HPP
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * A bump allocator for short-lived text (slider labels, status lines) that only has to
+ * live until the end of the current frame.
+ *
+ * Everything allocated from the arena is released at once by reset(), at the start of
+ * each frame, so formatting text in the frame loop does not touch the heap. If a frame
+ * needs more than the current capacity, the strings that don't fit are allocated on the
+ * heap, one by one, and the capacity is increased in the next reset(). That happens only
+ * when the UI grows, e.g. after loading a model with more coefficients. Every string is
+ * formatted in full, so labels never turn empty, which would make ImGui widgets share IDs.
+ */
+class FrameArena
+{
+public:
+    explicit FrameArena(std::size_t capacity = 16 * 1024) : buffer(capacity){};
+
+    /**
+     * Releases everything that has been allocated in this frame. Grows the arena if the
+     * last frame ran out of space.
+     */
+    void reset()
+    {
+        if (required > buffer.size())
+        {
+            buffer.resize(2 * required);
+        }
+        overflow.clear();
+        used = 0;
+        required = 0;
+    };
+
+    /**
+     * Formats a string like printf, and returns a pointer to it. The pointer is valid until
+     * the next call to reset().
+     *
+     * @param[in] format A printf-style format string.
+     * @return The formatted, null-terminated string, or an empty string if the format is invalid.
+     */
+    const char* format(const char* format, ...)
+    {
+        std::va_list args, overflow_args;
+        va_start(args, format);
+        va_copy(overflow_args, args);
+        const int length = std::vsnprintf(buffer.data() + used, buffer.size() - used, format, args);
+        va_end(args);
+        if (length < 0)
+        {
+            va_end(overflow_args);
+            return "";
+        }
+        const std::size_t size = static_cast<std::size_t>(length) + 1;
+        required += size;
+        if (used + size > buffer.size())
+        {
+            overflow.emplace_back(size);
+            std::vsnprintf(overflow.back().data(), size, format, overflow_args);
+            va_end(overflow_args);
+            return overflow.back().data();
+        }
+        va_end(overflow_args);
+        const char* str = buffer.data() + used;
+        used += size;
+        return str;
+    };
+
+private:
+    std::vector<char> buffer;
+    std::size_t used = 0;
+    std::size_t required = 0; // total size requested in this frame, including the requests that didn't fit
+    std::vector<std::vector<char>> overflow; // the strings of this frame that didn't fit into the buffer
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_FRAMEARENA_HPP */
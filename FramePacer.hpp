@@ -0,0 +1,116 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: FramePacer.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_FRAMEPACER_HPP
+#define EOSVIEWER_FRAMEPACER_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+
+namespace eosviewer {
+
+/**
+ * Limits the frame rate of the viewer, and measures its redraw rate.
+ *
+ * The libigl viewer only redraws when there's an input event, and continuously (at its
+ * animation_max_fps) while it is animating, which the viewer only does while a model is loading. So an
+ * idle viewer waits for events and doesn't use the CPU. A burst of events, e.g. while dragging a slider,
+ * would however redraw as fast as the events arrive. end_frame() is called at the end of each frame,
+ * and waits until at least 1/max_fps seconds have passed since the end of the previous one.
+ *
+ * The redraw rate is the number of frames that ended in the last second. It is at most max_fps while
+ * interacting, and low in the first frame after the viewer has been idle.
+ */
+class FramePacer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @param[in] max_fps The maximum number of frames per second, or 0 for no limit.
+     */
+    explicit FramePacer(double max_fps = 0.0) : max_fps(max_fps){};
+
+    /**
+     * Records the end of a frame. If a maximum frame rate is set, and the previous frame ended less than
+     * 1/max_fps seconds ago, this sleeps for the rest of that time first.
+     */
+    void end_frame()
+    {
+        auto now = clock::now();
+        if (max_fps > 0.0 && num_frames > 0)
+        {
+            const auto min_frame_time = std::chrono::duration_cast<clock::duration>(
+                std::chrono::duration<double>(1.0 / max_fps));
+            const auto frame_end = get_frame_end(0) + min_frame_time;
+            if (now < frame_end)
+            {
+                std::this_thread::sleep_until(frame_end);
+                now = clock::now();
+            }
+        }
+        frame_ends[num_frames % frame_ends.size()] = now;
+        ++num_frames;
+    };
+
+    /**
+     * The number of frames that ended in the second before the end of the last frame. Rates above the
+     * number of frames that are kept (see frame_ends) are reported as that number.
+     */
+    int get_redraw_rate() const
+    {
+        if (num_frames == 0)
+        {
+            return 0;
+        }
+        const auto last_frame_end = get_frame_end(0);
+        int rate = 0;
+        while (rate < static_cast<int>(std::min<std::size_t>(num_frames, frame_ends.size())) &&
+               last_frame_end - get_frame_end(rate) < std::chrono::seconds(1))
+        {
+            ++rate;
+        }
+        return rate;
+    };
+
+    double get_max_fps() const
+    {
+        return max_fps;
+    };
+
+private:
+    double max_fps;
+    std::array<clock::time_point, 256> frame_ends; // a ring buffer of the ends of the last frames
+    std::size_t num_frames = 0;
+
+    // Returns the end of the frame that ended the given number of frames before the last one:
+    clock::time_point get_frame_end(int frames_before_last) const
+    {
+        return frame_ends[(num_frames - 1 - frames_before_last) % frame_ends.size()];
+    };
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_FRAMEPACER_HPP */
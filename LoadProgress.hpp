@@ -0,0 +1,149 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: LoadProgress.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_LOADPROGRESS_HPP
+#define EOSVIEWER_LOADPROGRESS_HPP
+
+#include "trace.hpp"
+
+#include "cereal/archives/binary.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * The progress of a model load, which is updated by the loading thread and can be read from any
+ * other thread.
+ *
+ * The bytes are those read from (or, for a model container, mapped from) the model and blendshape
+ * files. The sections are the sections of a model container, or whole files for formats that are
+ * decoded in one piece. The totals grow as the files are opened.
+ */
+struct LoadProgress
+{
+    std::atomic<std::uint64_t> bytes_read{0};
+    std::atomic<std::uint64_t> bytes_total{0};
+    std::atomic<int> sections_decoded{0};
+    std::atomic<int> sections_total{0};
+
+    void reset()
+    {
+        bytes_read = 0;
+        bytes_total = 0;
+        sections_decoded = 0;
+        sections_total = 0;
+    };
+};
+
+/**
+ * A stream buffer that reads from another one, and counts the bytes read in a LoadProgress.
+ *
+ * Small reads (as cereal does for sizes and names) are buffered. Large reads (the matrices) go
+ * directly from the source to the destination, in chunks, so that the progress moves while a large
+ * matrix is being read.
+ */
+class ProgressStreambuf : public std::streambuf
+{
+public:
+    ProgressStreambuf(std::streambuf* source, LoadProgress& progress)
+        : source(source), progress(progress), buffer(64 * 1024){};
+
+protected:
+    int_type underflow() override
+    {
+        const auto num_read = source->sgetn(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (num_read <= 0)
+        {
+            return traits_type::eof();
+        }
+        progress.bytes_read += static_cast<std::uint64_t>(num_read);
+        setg(buffer.data(), buffer.data(), buffer.data() + num_read);
+        return traits_type::to_int_type(buffer[0]);
+    };
+
+    std::streamsize xsgetn(char* destination, std::streamsize count) override
+    {
+        // First, whatever is left in the buffer:
+        std::streamsize num_copied = std::min<std::streamsize>(count, egptr() - gptr());
+        std::memcpy(destination, gptr(), static_cast<std::size_t>(num_copied));
+        gbump(static_cast<int>(num_copied));
+        const std::streamsize chunk_size = 16 * 1024 * 1024;
+        while (num_copied < count)
+        {
+            const auto num_read =
+                source->sgetn(destination + num_copied, std::min(chunk_size, count - num_copied));
+            if (num_read <= 0)
+            {
+                break;
+            }
+            progress.bytes_read += static_cast<std::uint64_t>(num_read);
+            num_copied += num_read;
+        }
+        return num_copied;
+    };
+
+private:
+    std::streambuf* source;
+    LoadProgress& progress;
+    std::vector<char> buffer;
+};
+
+/**
+ * Reads an object from a file with a cereal BinaryArchive, as eos's load functions do, and
+ * reports the progress while reading.
+ *
+ * @param[in] filename The file to read.
+ * @param[out] object The object to read.
+ * @param[in,out] progress The progress, which is updated while reading. The file counts as one section.
+ * @throw std::runtime_error if the file can't be opened, or cereal's exceptions if it can't be read.
+ */
+template <class T>
+void load_binary_archive(const std::string& filename, T& object, LoadProgress& progress)
+{
+    // The file is read as it's decoded, so the two are one span:
+    trace::Span span("read & decode cereal archive");
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        throw std::runtime_error("Error opening given file: " + filename);
+    }
+    progress.bytes_total += static_cast<std::uint64_t>(file.tellg());
+    progress.sections_total += 1;
+    file.seekg(0);
+    ProgressStreambuf progress_buffer(file.rdbuf(), progress);
+    std::istream stream(&progress_buffer);
+    cereal::BinaryInputArchive input_archive(stream);
+    input_archive(object);
+    progress.sections_decoded += 1;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_LOADPROGRESS_HPP */
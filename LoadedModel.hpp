@@ -0,0 +1,249 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: LoadedModel.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_LOADEDMODEL_HPP
+#define EOSVIEWER_LOADEDMODEL_HPP
+
+#include "ModelView.hpp"
+#include "PackedBlendshapes.hpp"
+#include "trace.hpp"
+
+#include "eos/morphablemodel/MorphableModel.hpp"
+#include "eos/morphablemodel/Blendshape.hpp"
+#include "eos/cpp17/variant.hpp"
+
+#include "Eigen/Core"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * A model that has been loaded, i.e. a view on it, together with the storage that the view points
+ * into. The storage is either a MorphableModel on the heap, or a memory-mapped model container.
+ * Blendshapes that have been packed from a MorphableModel, or attached to a model with
+ * with_blendshapes(), have their own storage.
+ *
+ * Copies share the storage, which is released when the last copy is gone.
+ */
+struct LoadedModel
+{
+    ModelView view;
+    std::shared_ptr<const void> storage;
+    std::shared_ptr<const void> blendshapes_storage; // if blendshapes have been packed or attached
+    std::shared_ptr<const void> sparse_blendshapes_storage; // see with_sparse_blendshapes()
+
+    bool empty() const
+    {
+        return !storage;
+    };
+};
+
+/**
+ * Landmark definitions in the layout of ModelView: the vertex indices in one array, and the names,
+ * each terminated by '\0', one after another in another.
+ */
+struct PackedLandmarks
+{
+    std::vector<int> vertices;
+    std::vector<char> names;
+
+    PackedLandmarks() = default;
+
+    /**
+     * Packs the given landmarks, in the given order.
+     *
+     * @param[in] landmarks The landmarks to pack.
+     * @param[in] num_vertices The number of vertices of the model that the landmarks are defined on.
+     * @throw std::runtime_error if a landmark is defined on a vertex that the model doesn't have.
+     */
+    PackedLandmarks(const std::vector<LandmarkDefinition>& landmarks, int num_vertices)
+    {
+        for (const auto& landmark : landmarks)
+        {
+            if (landmark.vertex_index < 0 || landmark.vertex_index >= num_vertices)
+            {
+                throw std::runtime_error("The landmark " + landmark.name + " is defined on vertex " +
+                                         std::to_string(landmark.vertex_index) +
+                                         ", which the model doesn't have.");
+            }
+            vertices.push_back(landmark.vertex_index);
+            names.insert(end(names), begin(landmark.name), end(landmark.name));
+            names.push_back('\0');
+        }
+    };
+
+    /**
+     * Points the landmarks of the given view to these.
+     */
+    void set_view(ModelView& view) const
+    {
+        view.landmark_vertices = vertices.empty() ? nullptr : vertices.data();
+        view.landmark_names = names.empty() ? nullptr : names.data();
+        view.num_landmarks = static_cast<int>(vertices.size());
+        view.landmark_names_size = static_cast<int>(names.size());
+    };
+};
+
+namespace detail {
+
+/**
+ * The storage of a model that has been loaded from a .bin or .scm file: the model itself, plus the
+ * data that the viewer needs in a different layout than eos stores it.
+ */
+struct MorphableModelStorage
+{
+    eos::morphablemodel::MorphableModel morphable_model;
+    Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor> triangles;
+    Eigen::Matrix<float, Eigen::Dynamic, 2, Eigen::RowMajor> texture_coordinates;
+    PackedLandmarks landmarks;
+};
+
+} /* namespace detail */
+
+/**
+ * Takes ownership of the given model, and creates a view on it.
+ *
+ * If the model has blendshapes, they are packed, into a storage of their own. MorphableModel only gives
+ * const access to its parts, so they can't be moved out of it, and it keeps its own copy. Blendshapes
+ * are only a few columns though, compared to the PCA bases, which would all have to be copied to make a
+ * model without them. Nothing else is copied. The triangle list, texture coordinates and landmark
+ * definitions are converted to the layout of the view.
+ *
+ * @param[in] morphable_model The model, which is moved into the storage of the result.
+ * @return The loaded model.
+ * @throw std::runtime_error if a landmark is defined on a vertex that the model doesn't have.
+ */
+inline LoadedModel make_loaded_model(eos::morphablemodel::MorphableModel morphable_model)
+{
+    using namespace eos;
+    trace::Span span("make loaded model");
+    auto storage = std::make_shared<detail::MorphableModelStorage>();
+    storage->morphable_model = std::move(morphable_model);
+    const auto& model = storage->morphable_model;
+
+    LoadedModel loaded_model;
+    auto& view = loaded_model.view;
+    view.shape_model = make_view(model.get_shape_model());
+    view.color_model = make_view(model.get_color_model());
+    if (model.has_separate_expression_model())
+    {
+        const auto& expression_model = model.get_expression_model().value();
+        if (cpp17::holds_alternative<morphablemodel::PcaModel>(expression_model))
+        {
+            view.expression_model_type = ExpressionModelType::PcaModel;
+            view.expression_pca_model = make_view(cpp17::get<morphablemodel::PcaModel>(expression_model));
+        } else if (cpp17::holds_alternative<morphablemodel::Blendshapes>(expression_model))
+        {
+            auto packed_blendshapes = std::make_shared<PackedBlendshapes>(
+                cpp17::get<morphablemodel::Blendshapes>(expression_model));
+            view.expression_model_type = ExpressionModelType::Blendshapes;
+            view.blendshapes = packed_blendshapes->get_deformations().data();
+            view.num_blendshapes = packed_blendshapes->get_num_blendshapes();
+            loaded_model.blendshapes_storage = std::move(packed_blendshapes);
+        }
+    }
+
+    const auto& triangle_list = model.get_shape_model().get_triangle_list();
+    storage->triangles.resize(triangle_list.size(), 3);
+    for (std::size_t i = 0; i < triangle_list.size(); ++i)
+    {
+        storage->triangles.row(i) << triangle_list[i][0], triangle_list[i][1], triangle_list[i][2];
+    }
+    view.triangles = storage->triangles.data();
+    view.num_triangles = static_cast<int>(triangle_list.size());
+
+    const auto texture_coordinates = model.get_texture_coordinates();
+    storage->texture_coordinates.resize(texture_coordinates.size(), 2);
+    for (std::size_t i = 0; i < texture_coordinates.size(); ++i)
+    {
+        storage->texture_coordinates.row(i) << static_cast<float>(texture_coordinates[i][0]),
+            static_cast<float>(texture_coordinates[i][1]);
+    }
+    view.texture_coordinates = storage->texture_coordinates.data();
+    view.num_texture_coordinates = static_cast<int>(texture_coordinates.size());
+
+    if (model.get_landmark_definitions())
+    {
+        std::vector<LandmarkDefinition> landmarks;
+        for (const auto& landmark : model.get_landmark_definitions().value())
+        {
+            landmarks.push_back({landmark.first, landmark.second});
+        }
+        // The definitions are a hash map, so they are sorted, to be in the same order on every load. Shorter
+        // names first, so that numbered landmarks ("1", ..., "68") are in the order of their numbers:
+        std::sort(begin(landmarks), end(landmarks), [](const auto& lhs, const auto& rhs) {
+            return lhs.name.size() != rhs.name.size() ? lhs.name.size() < rhs.name.size()
+                                                      : lhs.name < rhs.name;
+        });
+        storage->landmarks = PackedLandmarks(landmarks, view.shape_model.get_data_dimension() / 3);
+        storage->landmarks.set_view(view);
+    }
+
+    loaded_model.storage = std::move(storage);
+    return loaded_model;
+};
+
+/**
+ * Returns a model consisting of the identity and colour models of the given model, and the given
+ * blendshapes as expression model. The storage of the given model is shared, not copied. Blendshapes
+ * that were packed for it before (by make_loaded_model() or with_blendshapes()) are released, but if its
+ * storage is a MorphableModel with blendshapes of its own, those stay in memory as long as the storage.
+ * The given blendshapes are released one by one while they are packed.
+ *
+ * @param[in] model A loaded model.
+ * @param[in] blendshapes The blendshapes. They have to have the dimension of the shape model.
+ * @return The model with blendshapes.
+ * @throw std::runtime_error if the blendshapes don't match the shape model.
+ */
+inline LoadedModel with_blendshapes(const LoadedModel& model, eos::morphablemodel::Blendshapes blendshapes)
+{
+    trace::Span span("attach blendshapes");
+    auto packed_blendshapes = std::make_shared<PackedBlendshapes>(std::move(blendshapes));
+    if (packed_blendshapes->get_num_blendshapes() > 0 &&
+        packed_blendshapes->get_data_dimension() != model.view.shape_model.get_data_dimension())
+    {
+        throw std::runtime_error("The blendshapes do not have the same dimension as the shape model.");
+    }
+
+    LoadedModel result;
+    result.view = model.view;
+    result.view.expression_model_type = ExpressionModelType::Blendshapes;
+    result.view.expression_pca_model = PcaModelView();
+    result.view.blendshapes = packed_blendshapes->get_deformations().data();
+    result.view.blendshapes_column_scales = nullptr;
+    result.view.blendshapes_precision = BasisPrecision::Float32;
+    result.view.sparse_blendshapes = SparseBasisView();
+    result.view.num_blendshapes = packed_blendshapes->get_num_blendshapes();
+    result.storage = model.storage;
+    result.blendshapes_storage = std::move(packed_blendshapes);
+    return result;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_LOADEDMODEL_HPP */
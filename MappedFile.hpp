@@ -0,0 +1,200 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: MappedFile.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_MAPPEDFILE_HPP
+#define EOSVIEWER_MAPPEDFILE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace eosviewer {
+
+/**
+ * A file that is mapped read-only into memory, with mmap on POSIX systems and a file mapping on
+ * Windows.
+ *
+ * The mapping is shared, so the pages are backed by the OS's page cache: they are only read from
+ * disk when they are first accessed, and several processes that map the same file share them.
+ */
+class MappedFile
+{
+public:
+    /**
+     * Maps the given file.
+     *
+     * @param[in] filename The file to map.
+     * @throw std::runtime_error if the file can't be opened or mapped, or is empty.
+     */
+    explicit MappedFile(const std::string& filename)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("Error opening file: " + filename);
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+        {
+            CloseHandle(file);
+            throw std::runtime_error("Error: The file is empty or its size can't be read: " + filename);
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping)
+        {
+            throw std::runtime_error("Error mapping file: " + filename);
+        }
+        // The view keeps the mapping alive:
+        void* address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!address)
+        {
+            throw std::runtime_error("Error mapping file: " + filename);
+        }
+        mapped_size = static_cast<std::size_t>(file_size.QuadPart);
+#else
+        const int file = open(filename.c_str(), O_RDONLY);
+        if (file == -1)
+        {
+            throw std::runtime_error("Error opening file: " + filename);
+        }
+        struct stat file_status;
+        if (fstat(file, &file_status) != 0 || file_status.st_size == 0)
+        {
+            close(file);
+            throw std::runtime_error("Error: The file is empty or its size can't be read: " + filename);
+        }
+        mapped_size = static_cast<std::size_t>(file_status.st_size);
+        // The mapping stays valid after the file is closed:
+        void* address = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, file, 0);
+        close(file);
+        if (address == MAP_FAILED)
+        {
+            throw std::runtime_error("Error mapping file: " + filename);
+        }
+#endif
+        mapped_data = static_cast<const unsigned char*>(address);
+    };
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(mapped_data);
+#else
+        munmap(const_cast<unsigned char*>(mapped_data), mapped_size);
+#endif
+    };
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * The start of the mapping, which is aligned to (at least) the page size.
+     */
+    const unsigned char* data() const
+    {
+        return mapped_data;
+    };
+
+    std::size_t size() const
+    {
+        return mapped_size;
+    };
+
+    /**
+     * Asks the OS to start reading the given range of the file from disk, and returns without waiting
+     * for it. This is only a hint. On Windows, it does nothing, and the pages are read when they are
+     * first accessed (or by fault_in()).
+     *
+     * @param[in] offset The start of the range, in bytes from the start of the file.
+     * @param[in] length The length of the range in bytes. It is clipped to the end of the file.
+     */
+    void prefetch(std::size_t offset, std::size_t length) const
+    {
+#ifndef _WIN32
+        if (offset >= mapped_size || length == 0)
+        {
+            return;
+        }
+        length = std::min(length, mapped_size - offset);
+        // madvise() needs an address that is aligned to the page size:
+        const auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        const auto begin = offset / page_size * page_size;
+        madvise(const_cast<unsigned char*>(mapped_data) + begin, offset + length - begin, MADV_WILLNEED);
+#else
+        (void)offset;
+        (void)length;
+#endif
+    };
+
+    /**
+     * Reads one byte of every page of the given range, so that the whole range is in memory and
+     * mapped when this returns, and accessing it later doesn't cause page faults (as long as the
+     * OS doesn't evict the pages again).
+     *
+     * @param[in] offset The start of the range, in bytes from the start of the file.
+     * @param[in] length The length of the range in bytes. It is clipped to the end of the file.
+     */
+    void fault_in(std::size_t offset, std::size_t length) const
+    {
+        if (offset >= mapped_size || length == 0)
+        {
+            return;
+        }
+        const auto end = offset + std::min(length, mapped_size - offset);
+        const std::size_t min_page_size = 4096;
+        unsigned char checksum = mapped_data[end - 1];
+        for (auto position = offset; position < end; position += min_page_size)
+        {
+            checksum ^= mapped_data[position];
+        }
+        // Keeps the compiler from removing the reads:
+        volatile unsigned char sink = checksum;
+        (void)sink;
+    };
+
+private:
+    const unsigned char* mapped_data = nullptr;
+    std::size_t mapped_size = 0;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_MAPPEDFILE_HPP */
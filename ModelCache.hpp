@@ -0,0 +1,332 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: ModelCache.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_MODELCACHE_HPP
+#define EOSVIEWER_MODELCACHE_HPP
+
+#include "LoadedModel.hpp"
+#include "LoadProgress.hpp"
+#include "MappedFile.hpp"
+#include "ModelLoaderRegistry.hpp"
+#include "model_container.hpp"
+#include "trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace eosviewer {
+
+/**
+ * An on-disk cache of models that have been converted to native model containers (see
+ * model_container.hpp).
+ *
+ * The first time a .bin or .scm model (with or without separate blendshapes) is loaded, it is parsed
+ * as usual, and then written to the cache directory as container, which includes the packed
+ * blendshapes and the triangle list in the layout the viewer uses. The next time the same files are
+ * loaded, the container is memory-mapped instead, and nothing is parsed.
+ *
+ * Cache entries are keyed by a hash of the content of the files, so a renamed or copied file still
+ * hits the cache, and a changed file never does. To not have to read a file to find its entry, the
+ * hash of each file is remembered together with the file's size and modification time, and is only
+ * computed again if one of those has changed. An entry that can't be loaded (e.g. because it has
+ * been written by a different version) is replaced.
+ */
+namespace model_cache {
+
+/**
+ * Computes the 64-bit FNV-1a hash of the content of the given file.
+ *
+ * @param[in] filename The file to hash.
+ * @return The hash.
+ * @throw std::runtime_error if the file can't be read.
+ */
+inline std::uint64_t hash_file(const std::string& filename)
+{
+    const MappedFile file(filename);
+    std::uint64_t hash = 14695981039346656037ull;
+    for (std::size_t i = 0; i < file.size(); ++i)
+    {
+        hash = (hash ^ file.data()[i]) * 1099511628211ull;
+    }
+    return hash;
+};
+
+/**
+ * Computes the 64-bit FNV-1a hash of a string.
+ */
+inline std::uint64_t hash_string(const std::string& string)
+{
+    std::uint64_t hash = 14695981039346656037ull;
+    for (const auto character : string)
+    {
+        hash = (hash ^ static_cast<unsigned char>(character)) * 1099511628211ull;
+    }
+    return hash;
+};
+
+inline std::string to_hex(std::uint64_t value)
+{
+    char hex[17];
+    std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(value));
+    return hex;
+};
+
+/**
+ * Returns a suffix for temporary files that is unique among all running processes, and among the
+ * calls in this process: the id of the process, and a counter.
+ */
+inline std::string get_unique_suffix()
+{
+#ifdef _WIN32
+    const auto process_id = _getpid();
+#else
+    const auto process_id = getpid();
+#endif
+    static std::atomic<std::uint64_t> counter{0};
+    return std::to_string(process_id) + "-" + std::to_string(counter++);
+};
+
+/**
+ * The size and the modification time (in seconds) of a file.
+ */
+struct FileStatus
+{
+    std::uint64_t size = 0;
+    std::int64_t modification_time = 0;
+};
+
+/**
+ * Returns the size and modification time of the given file.
+ *
+ * @throw std::runtime_error if the file doesn't exist.
+ */
+inline FileStatus get_file_status(const std::string& filename)
+{
+    FileStatus status;
+#ifdef _WIN32
+    struct _stat64 file_status;
+    if (_stat64(filename.c_str(), &file_status) != 0)
+#else
+    struct stat file_status;
+    if (stat(filename.c_str(), &file_status) != 0)
+#endif
+    {
+        throw std::runtime_error("Error: Can't read the status of file " + filename);
+    }
+    status.size = static_cast<std::uint64_t>(file_status.st_size);
+    status.modification_time = static_cast<std::int64_t>(file_status.st_mtime);
+    return status;
+};
+
+/**
+ * Creates the given directory, and its parents, if they don't exist yet.
+ *
+ * @return Whether the directory exists now.
+ */
+inline bool create_directories(const std::string& directory)
+{
+    for (std::size_t end = 1; end <= directory.size(); ++end)
+    {
+        if (end == directory.size() || directory[end] == '/' || directory[end] == '\\')
+        {
+            const auto parent = directory.substr(0, end);
+#ifdef _WIN32
+            _mkdir(parent.c_str());
+#else
+            mkdir(parent.c_str(), 0755);
+#endif
+        }
+    }
+    struct stat status;
+    return stat(directory.c_str(), &status) == 0 && (status.st_mode & S_IFDIR) != 0;
+};
+
+/**
+ * Returns the default cache directory: eos-model-viewer in the user's cache directory
+ * ($XDG_CACHE_HOME, ~/.cache, or %LOCALAPPDATA% on Windows), or an empty string if there is none.
+ */
+inline std::string get_default_directory()
+{
+#ifdef _WIN32
+    const char* local_app_data = std::getenv("LOCALAPPDATA");
+    return local_app_data ? std::string(local_app_data) + "\\eos-model-viewer" : std::string();
+#else
+    const char* cache_home = std::getenv("XDG_CACHE_HOME");
+    if (cache_home && cache_home[0] != '\0')
+    {
+        return std::string(cache_home) + "/eos-model-viewer";
+    }
+    const char* home = std::getenv("HOME");
+    return home ? std::string(home) + "/.cache/eos-model-viewer" : std::string();
+#endif
+};
+
+/**
+ * Returns the hash of the content of the given file. If the cache directory has a record of the file
+ * with the same size and modification time, the hash is taken from there. Otherwise, the file is
+ * hashed, and the record is (re-)written.
+ *
+ * As modification times only have a resolution of one second, a file could be changed again within the
+ * second in which it was hashed, without its modification time changing. So a record is only trusted if
+ * the file had last been modified before the second in which the record was written.
+ *
+ * @param[in] cache_directory The cache directory, which has to exist.
+ * @param[in] filename The file whose content to hash.
+ * @return The hash.
+ * @throw std::runtime_error if the file can't be read.
+ */
+inline std::uint64_t get_content_hash(const std::string& cache_directory, const std::string& filename)
+{
+    const auto status = get_file_status(filename);
+    const auto record_filename = cache_directory + "/file-" + to_hex(hash_string(filename)) + ".txt";
+    {
+        std::ifstream record(record_filename);
+        std::string recorded_filename;
+        FileStatus recorded_status;
+        std::string recorded_hash;
+        std::int64_t record_time = 0;
+        std::getline(record, recorded_filename);
+        record >> recorded_status.size >> recorded_status.modification_time >> recorded_hash >> record_time;
+        if (record && recorded_filename == filename && recorded_status.size == status.size &&
+            recorded_status.modification_time == status.modification_time &&
+            status.modification_time < record_time && recorded_hash.size() == 16)
+        {
+            return std::strtoull(recorded_hash.c_str(), nullptr, 16);
+        }
+    }
+    const auto record_time = static_cast<std::int64_t>(std::time(nullptr));
+    const auto hash = hash_file(filename);
+    std::ofstream record(record_filename);
+    record << filename << "\n"
+           << status.size << " " << status.modification_time << " " << to_hex(hash) << " " << record_time
+           << "\n";
+    return hash;
+};
+
+/**
+ * Loads a model through the cache: if there's an entry for the given files, it is loaded with
+ * load_model_container(). Otherwise, the model is loaded with the given function, and written to the
+ * cache. Whether the cache was hit, and the time it took, are written to the log.
+ *
+ * If the cache directory can't be created, or an entry can't be written, the model is loaded as if
+ * there was no cache.
+ *
+ * @param[in] cache_directory The cache directory. It is created if it doesn't exist.
+ * @param[in] model_file The model file.
+ * @param[in] blendshapes_file The blendshapes file, or an empty string if there are none.
+ * @param[in] load_model Loads the model from the given files, if it isn't in the cache.
+ * @param[in,out] progress The progress of the load.
+ * @param[in] options How to load the cache entry, see load_model_container().
+ * @param[in] log Where to report hits and misses.
+ * @return The loaded model.
+ * @throw std::runtime_error if the model files can't be read, or load_model throws.
+ */
+inline LoadedModel load_cached_model(const std::string& cache_directory, const std::string& model_file,
+                                     const std::string& blendshapes_file,
+                                     const std::function<LoadedModel()>& load_model, LoadProgress& progress,
+                                     const ModelLoadOptions& options, std::ostream& log)
+{
+    using clock = std::chrono::steady_clock;
+    const auto seconds_since = [](clock::time_point start) {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    };
+    if (!create_directories(cache_directory))
+    {
+        log << "Model cache: Can't create the cache directory " << cache_directory << ", not caching."
+            << std::endl;
+        return load_model();
+    }
+
+    const auto hash_start = clock::now();
+    auto entry_name = "model-" + to_hex(get_content_hash(cache_directory, model_file));
+    if (!blendshapes_file.empty())
+    {
+        entry_name += "-" + to_hex(get_content_hash(cache_directory, blendshapes_file));
+    }
+    const auto entry_filename = cache_directory + "/" + entry_name + ".eosm";
+    const auto hash_time = seconds_since(hash_start);
+    trace::add_span("hash model files", hash_start, clock::now());
+
+    const auto load_start = clock::now();
+    if (std::ifstream(entry_filename))
+    {
+        try
+        {
+            auto model = load_model_container(entry_filename, &progress, options.num_resident_components,
+                                              options.thread_pool);
+            log << "Model cache hit: " << entry_name << " (hashing: " << hash_time
+                << " s, loading: " << seconds_since(load_start) << " s)." << std::endl;
+            return model;
+        } catch (const std::runtime_error& e)
+        {
+            log << "Model cache: Replacing the invalid entry " << entry_name << ": " << e.what() << std::endl;
+            std::remove(entry_filename.c_str());
+        }
+    }
+
+    auto model = load_model();
+    const auto load_time = seconds_since(load_start);
+    // Write to a temporary file first, so that an interrupted write never leaves a broken entry. Its name is
+    // unique, so that other viewers that write the same entry at the same time don't write into it:
+    const auto write_start = clock::now();
+    const auto temporary_filename = entry_filename + "." + get_unique_suffix() + ".tmp";
+    try
+    {
+        write_model_container(temporary_filename, model.view);
+        if (std::rename(temporary_filename.c_str(), entry_filename.c_str()) != 0)
+        {
+            throw std::runtime_error("Error renaming " + temporary_filename);
+        }
+        log << "Model cache miss: " << entry_name << " (hashing: " << hash_time << " s, loading: "
+            << load_time << " s, writing the cache entry: " << seconds_since(write_start) << " s)."
+            << std::endl;
+    } catch (const std::runtime_error& e)
+    {
+        std::remove(temporary_filename.c_str());
+        log << "Model cache miss: " << entry_name << ", but the entry can't be written: " << e.what()
+            << std::endl;
+    }
+    return model;
+};
+
+} /* namespace model_cache */
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_MODELCACHE_HPP */
@@ -0,0 +1,731 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: ModelEvaluator.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_MODELEVALUATOR_HPP
+#define EOSVIEWER_MODELEVALUATOR_HPP
+
+#include "ModelView.hpp"
+#include "tiled_kernels.hpp"
+#include "ThreadPool.hpp"
+
+#include "Eigen/Core"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * Adds a sample of the given PCA model to the given instance, i.e. computes
+ * instance += mean + basis * coefficients, with the rescaled PCA basis.
+ *
+ * Unlike PcaModel::draw_sample(), which copies the coefficients and returns a newly
+ * allocated vector, this does not allocate. If fewer coefficients than principal
+ * components are given, the remaining ones are treated as zero. Only the basis columns up to
+ * the last non-zero coefficient are read, see get_num_used_coefficients(). The product is computed
+ * with the kernels selected for this CPU (see kernels.hpp), in tiles of vertices.
+ *
+ * @param[in] pca_model The PCA model.
+ * @param[in] coefficients The PCA coefficients.
+ * @param[in,out] instance The instance to add the sample to, of the model's data dimension.
+ * @param[in] thread_pool If given, the tiles are processed in parallel on this pool.
+ */
+/**
+ * The number of coefficients that an evaluation has to use: up to the last non-zero one, and at
+ * most \p max_coefficients. The trailing zero coefficients add nothing, so their basis columns are
+ * not read at all. For a memory-mapped model container, these columns then stay on disk until one
+ * of their sliders is moved (see default_num_resident_components in model_container.hpp).
+ *
+ * @param[in] coefficients The coefficients.
+ * @param[in] max_coefficients The number of columns of the basis.
+ * @return The number of coefficients to evaluate.
+ */
+inline int get_num_used_coefficients(const std::vector<float>& coefficients, int max_coefficients)
+{
+    auto num_coefficients = std::min(static_cast<int>(coefficients.size()), max_coefficients);
+    while (num_coefficients > 0 && coefficients[num_coefficients - 1] == 0.0f)
+    {
+        --num_coefficients;
+    }
+    return num_coefficients;
+};
+
+inline void add_sample(const PcaModelView& pca_model, const std::vector<float>& coefficients,
+                       Eigen::VectorXf& instance, ThreadPool* thread_pool = nullptr)
+{
+    const auto basis = pca_model.get_rescaled_pca_basis();
+    const auto num_coefficients = get_num_used_coefficients(coefficients, basis.cols);
+    instance += pca_model.get_mean();
+    kernels::gemv_add(thread_pool, basis, num_coefficients, coefficients.data(), instance.data());
+};
+
+/**
+ * Adds delta times the given column of a basis (or packed blendshapes) to the instance.
+ */
+inline void add_column(const BasisView& basis, int index, float delta, Eigen::VectorXf& instance,
+                       ThreadPool* thread_pool = nullptr)
+{
+    kernels::axpy(thread_pool, delta, basis, index, instance.data());
+};
+
+/**
+ * The kinds of expression models, as policies with which the evaluation is specialised at compile time,
+ * see visit_expression_model(). Each has:
+ *
+ *   has_expressions: Whether the model has an expression model at all.
+ *   add_sample(model, coefficients, instance, thread_pool): Adds the expression instance given by the
+ *       coefficients to the given instance.
+ *   add_column(model, index, delta, instance, thread_pool): Adds delta times the given principal
+ *       component or blendshape to the given instance.
+ */
+namespace expression_models {
+
+struct NoExpressions
+{
+    static const bool has_expressions = false;
+
+    static const char* name()
+    {
+        return "no expressions";
+    };
+
+    static void add_sample(const ModelView&, const std::vector<float>&, Eigen::VectorXf&, ThreadPool*){};
+
+    static void add_column(const ModelView&, int, float, Eigen::VectorXf&, ThreadPool*){};
+};
+
+struct PcaExpressions
+{
+    static const bool has_expressions = true;
+
+    static const char* name()
+    {
+        return "PCA expressions";
+    };
+
+    static void add_sample(const ModelView& model, const std::vector<float>& coefficients,
+                           Eigen::VectorXf& instance, ThreadPool* thread_pool)
+    {
+        eosviewer::add_sample(model.expression_pca_model, coefficients, instance, thread_pool);
+    };
+
+    static void add_column(const ModelView& model, int index, float delta, Eigen::VectorXf& instance,
+                           ThreadPool* thread_pool)
+    {
+        eosviewer::add_column(model.expression_pca_model.get_rescaled_pca_basis(), index, delta, instance,
+                              thread_pool);
+    };
+};
+
+struct DenseBlendshapes
+{
+    static const bool has_expressions = true;
+
+    static const char* name()
+    {
+        return "blendshapes";
+    };
+
+    static void add_sample(const ModelView& model, const std::vector<float>& coefficients,
+                           Eigen::VectorXf& instance, ThreadPool* thread_pool)
+    {
+        const auto num_coefficients = get_num_used_coefficients(coefficients, model.num_blendshapes);
+        kernels::gemv_add(thread_pool, model.get_expression_basis(), num_coefficients, coefficients.data(),
+                          instance.data());
+    };
+
+    static void add_column(const ModelView& model, int index, float delta, Eigen::VectorXf& instance,
+                           ThreadPool* thread_pool)
+    {
+        eosviewer::add_column(model.get_expression_basis(), index, delta, instance, thread_pool);
+    };
+};
+
+/**
+ * Blendshapes that are evaluated sparse, see SparseBlendshapes.hpp. The incremental update only
+ * touches the vertices that the blendshape moves.
+ */
+struct SparseBlendshapes
+{
+    static const bool has_expressions = true;
+
+    static const char* name()
+    {
+        return "sparse blendshapes";
+    };
+
+    static void add_sample(const ModelView& model, const std::vector<float>& coefficients,
+                           Eigen::VectorXf& instance, ThreadPool* thread_pool)
+    {
+        const auto num_coefficients = get_num_used_coefficients(coefficients, model.num_blendshapes);
+        kernels::gemv_add(thread_pool, model.sparse_blendshapes, num_coefficients, coefficients.data(),
+                          instance.data());
+    };
+
+    static void add_column(const ModelView& model, int index, float delta, Eigen::VectorXf& instance,
+                           ThreadPool*)
+    {
+        kernels::axpy(delta, model.sparse_blendshapes, index, instance.data());
+    };
+};
+
+} /* namespace expression_models */
+
+/**
+ * Calls f with the policy of the expression model of the given model (see expression_models), so
+ * that f can be specialised for it at compile time, and returns its result.
+ *
+ * @param[in] model The model.
+ * @param[in] f A callable that takes any of the policies of expression_models.
+ * @return The result of f.
+ */
+template <class Function>
+auto visit_expression_model(const ModelView& model, Function&& f)
+    -> decltype(f(expression_models::NoExpressions()))
+{
+    switch (model.expression_model_type)
+    {
+    case ExpressionModelType::PcaModel:
+        return f(expression_models::PcaExpressions());
+    case ExpressionModelType::Blendshapes:
+        if (!model.sparse_blendshapes.empty())
+        {
+            return f(expression_models::SparseBlendshapes());
+        }
+        return f(expression_models::DenseBlendshapes());
+    default:
+        return f(expression_models::NoExpressions());
+    }
+};
+
+/**
+ * Adds the expression instance given by the coefficients (a PCA model sample, or a linear
+ * combination of the packed blendshapes) to the given shape instance. Does nothing if the
+ * model has no separate expression model.
+ *
+ * @param[in] model The model whose expression model to use.
+ * @param[in] coefficients The expression coefficients.
+ * @param[in,out] instance The shape instance to add the expression to.
+ * @param[in] thread_pool If given, the vertices are processed in parallel on this pool.
+ */
+inline void add_expression_sample(const ModelView& model, const std::vector<float>& coefficients,
+                                  Eigen::VectorXf& instance, ThreadPool* thread_pool = nullptr)
+{
+    visit_expression_model(model, [&](auto expression_model) {
+        decltype(expression_model)::add_sample(model, coefficients, instance, thread_pool);
+    });
+};
+
+/**
+ * Adds delta times the given column of the expression model (a principal component, or a blendshape)
+ * to the shape instance.
+ */
+inline void add_expression_column(const ModelView& model, int index, float delta, Eigen::VectorXf& instance,
+                                  ThreadPool* thread_pool = nullptr)
+{
+    visit_expression_model(model, [&](auto expression_model) {
+        decltype(expression_model)::add_column(model, index, delta, instance, thread_pool);
+    });
+};
+
+/**
+ * The parts of a Morphable Model instance that can be re-evaluated independently.
+ */
+enum class ModelPart { Shape, Expression, Color };
+
+/**
+ * Describes how a coefficient vector differs from the one that was last evaluated.
+ */
+struct CoefficientChange
+{
+    enum class Kind { None, Single, Multiple };
+    Kind kind = Kind::None;
+    int index = -1;     ///< Index of the changed coefficient, if kind is Single.
+    float delta = 0.0f; ///< Difference to the previous value, if kind is Single.
+};
+
+/**
+ * Compares two coefficient vectors and finds out whether none, exactly one, or more than one of the
+ * coefficients have changed. Vectors of different sizes are considered as a Multiple change.
+ *
+ * @param[in] current The current coefficients.
+ * @param[in] previous The coefficients that were last evaluated.
+ * @return The kind of change, and the index and delta if a single coefficient changed.
+ */
+inline CoefficientChange find_coefficient_change(const std::vector<float>& current,
+                                                 const std::vector<float>& previous)
+{
+    CoefficientChange change;
+    if (current.size() != previous.size())
+    {
+        change.kind = CoefficientChange::Kind::Multiple;
+        return change;
+    }
+    for (std::size_t i = 0; i < current.size(); ++i)
+    {
+        if (current[i] != previous[i])
+        {
+            if (change.kind == CoefficientChange::Kind::Single)
+            {
+                change.kind = CoefficientChange::Kind::Multiple;
+                return change;
+            }
+            change.kind = CoefficientChange::Kind::Single;
+            change.index = static_cast<int>(i);
+            change.delta = current[i] - previous[i];
+        }
+    }
+    return change;
+};
+
+/**
+ * Tells the caller which of the evaluated instances have changed in a call to
+ * ModelEvaluator::update(), and thus have to be re-uploaded to the viewer.
+ */
+struct UpdateResult
+{
+    bool vertices_changed = false;
+    bool colors_changed = false;
+};
+
+namespace detail {
+
+/**
+ * The interface of the SpecialisedModelEvaluator of each kind of expression model.
+ */
+class ModelEvaluatorInterface
+{
+public:
+    virtual ~ModelEvaluatorInterface() = default;
+
+    /**
+     * Re-evaluates the parts of the model that are marked in \p dirty (shp, exp, col) with the given
+     * coefficients, on the given thread pool (or the calling thread, if nullptr). See
+     * ModelEvaluator::update().
+     */
+    virtual UpdateResult update(const std::vector<float>& shape_coefficients,
+                                const std::vector<float>& expression_coefficients,
+                                const std::vector<float>& color_coefficients, bool use_expressions,
+                                const std::array<bool, 3>& dirty, ThreadPool* thread_pool) = 0;
+
+    virtual const Eigen::VectorXf& get_shape_instance() const = 0;
+
+    virtual const Eigen::VectorXf& get_color_instance() const = 0;
+
+    virtual const char* get_expression_model_name() const = 0;
+};
+
+} /* namespace detail */
+
+/**
+ * The evaluation of a model with a particular kind of expression model (see expression_models),
+ * which is chosen at compile time, so the evaluation doesn't check the kind of the expression
+ * model, nor whether there is one, and the code of the other kinds isn't part of it. Usually, this
+ * is used through ModelEvaluator, but it can also be used (and benchmarked) on its own.
+ */
+template <class ExpressionModel>
+class SpecialisedModelEvaluator final : public detail::ModelEvaluatorInterface
+{
+public:
+    /**
+     * @param[in] model_view The model to evaluate. Its expression model has to be of the kind
+     *                       ExpressionModel. The model's storage has to outlive the evaluator.
+     */
+    explicit SpecialisedModelEvaluator(const ModelView& model_view) : model(model_view){};
+
+    UpdateResult update(const std::vector<float>& shape_coefficients,
+                        const std::vector<float>& expression_coefficients,
+                        const std::vector<float>& color_coefficients, bool use_expressions,
+                        const std::array<bool, 3>& dirty, ThreadPool* thread_pool) override
+    {
+        using Kind = CoefficientChange::Kind;
+        const auto is_dirty = [&dirty](ModelPart part) { return dirty[static_cast<std::size_t>(part)]; };
+        UpdateResult result;
+        const auto& shape_model = model.get_shape_model();
+        const bool add_expressions =
+            ExpressionModel::has_expressions && use_expressions && !expression_coefficients.empty();
+        if ((is_dirty(ModelPart::Shape) || is_dirty(ModelPart::Expression)) &&
+            shape_model.get_num_principal_components() > 0)
+        {
+            const auto dimension = shape_model.get_data_dimension();
+            const auto identity_change = update_layer(
+                identity, shape_coefficients, dimension,
+                [&](Eigen::VectorXf& instance) {
+                    add_sample(shape_model, shape_coefficients, instance, thread_pool);
+                },
+                [&](int index, float delta, Eigen::VectorXf& instance) {
+                    add_column(shape_model.get_rescaled_pca_basis(), index, delta, instance, thread_pool);
+                });
+            // If the expressions are switched off, the expression layer is kept as it is, so switching
+            // them on again only costs the addition of the layers:
+            const auto expression_change =
+                add_expressions
+                    ? update_layer(
+                          expression, expression_coefficients, dimension,
+                          [&](Eigen::VectorXf& instance) {
+                              ExpressionModel::add_sample(model, expression_coefficients, instance,
+                                                          thread_pool);
+                          },
+                          [&](int index, float delta, Eigen::VectorXf& instance) {
+                              ExpressionModel::add_column(model, index, delta, instance, thread_pool);
+                          })
+                    : CoefficientChange();
+
+            if (!shape_instance_valid || add_expressions != expressions_added ||
+                identity_change.kind == Kind::Multiple || expression_change.kind == Kind::Multiple)
+            {
+                // O(V), plus the evaluation of the layer that changed:
+                shape_instance = identity.instance;
+                if (add_expressions)
+                {
+                    shape_instance += expression.instance;
+                }
+                shape_instance_valid = true;
+                expressions_added = add_expressions;
+                result.vertices_changed = true;
+            } else if (identity_change.kind == Kind::Single || expression_change.kind == Kind::Single)
+            {
+                // The same rank-1 updates as to the layers, which is as cheap as adding the layers:
+                if (identity_change.kind == Kind::Single)
+                {
+                    add_column(shape_model.get_rescaled_pca_basis(), identity_change.index,
+                               identity_change.delta, shape_instance, thread_pool);
+                }
+                if (expression_change.kind == Kind::Single)
+                {
+                    ExpressionModel::add_column(model, expression_change.index, expression_change.delta,
+                                                shape_instance, thread_pool);
+                }
+                result.vertices_changed = true;
+            }
+        }
+
+        const auto& color_model = model.get_color_model();
+        if (is_dirty(ModelPart::Color) && color_model.get_num_principal_components() > 0)
+        {
+            const auto color_change = update_layer(
+                color, color_coefficients, color_model.get_data_dimension(),
+                [&](Eigen::VectorXf& instance) {
+                    add_sample(color_model, color_coefficients, instance, thread_pool);
+                },
+                [&](int index, float delta, Eigen::VectorXf& instance) {
+                    add_column(color_model.get_rescaled_pca_basis(), index, delta, instance, thread_pool);
+                });
+            result.colors_changed = color_change.kind != Kind::None;
+        }
+        return result;
+    };
+
+    /**
+     * The current shape instance (identity plus expression), as x_0, y_0, z_0, x_1, ...
+     */
+    const Eigen::VectorXf& get_shape_instance() const override
+    {
+        return shape_instance;
+    };
+
+    /**
+     * The current colour instance, as r_0, g_0, b_0, r_1, ...
+     */
+    const Eigen::VectorXf& get_color_instance() const override
+    {
+        return color.instance;
+    };
+
+    const char* get_expression_model_name() const override
+    {
+        return ExpressionModel::name();
+    };
+
+private:
+    // After this many rank-1 updates, a layer is re-evaluated from scratch, to bound the drift:
+    const int max_incremental_updates = 100;
+
+    /**
+     * An instance of one part of the model, and the coefficients it has been evaluated with.
+     */
+    struct Layer
+    {
+        Eigen::VectorXf instance;
+        bool valid = false;
+        int num_incremental_updates = 0;
+        std::vector<float> evaluated_coefficients;
+    };
+
+    /**
+     * Brings the given layer up to date with the given coefficients. If a single coefficient has
+     * changed, add_column(index, delta, instance) is called, otherwise, the layer is set to zero and
+     * evaluate(instance) is called.
+     *
+     * @return The change of the coefficients. Its kind is Multiple if the layer has been re-evaluated.
+     */
+    template <class Evaluate, class AddColumn>
+    CoefficientChange update_layer(Layer& layer, const std::vector<float>& coefficients, int dimension,
+                                   Evaluate&& evaluate, AddColumn&& add_column)
+    {
+        using Kind = CoefficientChange::Kind;
+        auto change = find_coefficient_change(coefficients, layer.evaluated_coefficients);
+        if (!layer.valid || layer.num_incremental_updates >= max_incremental_updates ||
+            change.kind == Kind::Multiple)
+        {
+            layer.instance.setZero(dimension);
+            evaluate(layer.instance);
+            layer.num_incremental_updates = 0;
+            layer.valid = true;
+            change.kind = Kind::Multiple;
+        } else if (change.kind == Kind::Single)
+        {
+            add_column(change.index, change.delta, layer.instance);
+            ++layer.num_incremental_updates;
+        }
+        layer.evaluated_coefficients = coefficients;
+        return change;
+    };
+
+    ModelView model;
+
+    Layer identity;   // the shape model sample
+    Layer expression; // the expression offset, i.e. the expression model sample
+    Layer color;
+
+    // The sum of the identity and expression layers:
+    Eigen::VectorXf shape_instance;
+    bool shape_instance_valid = false;
+    bool expressions_added = false; // whether the expression layer is contained in shape_instance
+};
+
+/**
+ * Creates the SpecialisedModelEvaluator for the kind of expression model of the given model.
+ */
+inline std::unique_ptr<detail::ModelEvaluatorInterface> make_specialised_evaluator(const ModelView& model)
+{
+    return visit_expression_model(model, [&model](auto expression_model) {
+        return std::unique_ptr<detail::ModelEvaluatorInterface>(
+            new SpecialisedModelEvaluator<decltype(expression_model)>(model));
+    });
+};
+
+/**
+ * Evaluates shape, expression and colour instances of a Morphable Model, and only
+ * re-computes the parts that have been marked as dirty since the last update.
+ *
+ * The viewer marks parts as dirty when a slider changes, a button is pressed, or a
+ * new model is loaded. In all other frames, update() is a no-op, so an idle viewer
+ * does not evaluate the model at all (see eos-model-viewer/issues/5).
+ *
+ * The identity (shape model sample), the expression offset and the colour are kept resident
+ * as separate layers, and the shape instance is their sum. Only the layer whose coefficients
+ * have changed is re-evaluated, and then added to the other one in O(V), so animating the
+ * expressions of a fixed identity costs only the expression model, and vice versa. If only a
+ * single coefficient of a layer has changed (i.e. the user is dragging one slider), the layer
+ * and the shape instance are updated in O(V) by adding delta * basis_column(i), instead of
+ * evaluating the whole model. To bound the accumulated floating point error, every
+ * max_incremental_updates-th update of a layer is a full evaluation as well.
+ *
+ * The model is given as ModelView, so it is evaluated in place, whether it lives on the heap or
+ * in a memory-mapped model container. Blendshape expressions are packed into a contiguous matrix
+ * when the model is loaded, and evaluated as a single matrix-vector product, or, if they only move
+ * a few vertices each, as sparse blocks (see SparseBlendshapes.hpp).
+ *
+ * The instances and the copies of the evaluated coefficients are kept between updates, so
+ * once their sizes are established, update() does not allocate.
+ *
+ * If a thread pool is set, the evaluation is split into tiles of vertices that are processed
+ * in parallel. The result is bit-identical to the single-threaded evaluation.
+ *
+ * The evaluation itself is done by a SpecialisedModelEvaluator for the kind of expression model
+ * (PCA model, blendshapes, sparse blendshapes or none), which set_model() creates once. So per
+ * update, the kind of model is dispatched on once, with a virtual call.
+ */
+class ModelEvaluator
+{
+public:
+    /**
+     * Sets the model to evaluate, and discards the current instances, so that the next
+     * update() evaluates everything from scratch. This has to be called whenever a different
+     * model has been loaded.
+     *
+     * The evaluator keeps a copy of the view, so the model's storage has to stay alive until
+     * the next call to set_model().
+     *
+     * @param[in] model_view The model to evaluate.
+     */
+    void set_model(const ModelView& model_view)
+    {
+        evaluator = make_specialised_evaluator(model_view);
+        mark_all_dirty();
+    };
+
+    /**
+     * Sets a thread pool to evaluate the model on. If nullptr (the default), the model is
+     * evaluated on the calling thread. The pool has to outlive the evaluator.
+     */
+    void set_thread_pool(ThreadPool* pool)
+    {
+        thread_pool = pool;
+    };
+
+    /**
+     * Marks the given part of the model as changed.
+     *
+     * @param[in] part The part whose coefficients (or settings) have changed.
+     */
+    void mark_dirty(ModelPart part)
+    {
+        dirty[static_cast<std::size_t>(part)] = true;
+    };
+
+    /**
+     * Marks all parts as changed, e.g. after a model has been loaded or all
+     * coefficients have been reset.
+     */
+    void mark_all_dirty()
+    {
+        dirty.fill(true);
+    };
+
+    bool is_dirty(ModelPart part) const
+    {
+        return dirty[static_cast<std::size_t>(part)];
+    };
+
+    /**
+     * Re-evaluates the dirty parts of the current model with the given coefficients.
+     *
+     * If only the colour coefficients changed, the shape instance is left as it is, and vice versa.
+     * The expression part is only added if \p use_expressions is true, the model has a separate
+     * expression model, and expression coefficients are given.
+     *
+     * @param[in] shape_coefficients Coefficients of the shape PCA model.
+     * @param[in] expression_coefficients Coefficients of the expression PCA model or blendshapes.
+     * @param[in] color_coefficients Coefficients of the colour PCA model.
+     * @param[in] use_expressions Whether to add the expression part to the shape.
+     * @return Which of the instances have been updated.
+     */
+    UpdateResult update(const std::vector<float>& shape_coefficients,
+                        const std::vector<float>& expression_coefficients,
+                        const std::vector<float>& color_coefficients, bool use_expressions)
+    {
+        if (!evaluator)
+        {
+            return UpdateResult();
+        }
+        const auto result = evaluator->update(shape_coefficients, expression_coefficients, color_coefficients,
+                                              use_expressions, dirty, thread_pool);
+        dirty.fill(false);
+        return result;
+    };
+
+    /**
+     * The current shape instance (identity plus expression), as x_0, y_0, z_0, x_1, ...
+     */
+    const Eigen::VectorXf& get_shape_instance() const
+    {
+        return evaluator ? evaluator->get_shape_instance() : empty_instance;
+    };
+
+    /**
+     * The current colour instance, as r_0, g_0, b_0, r_1, ...
+     */
+    const Eigen::VectorXf& get_color_instance() const
+    {
+        return evaluator ? evaluator->get_color_instance() : empty_instance;
+    };
+
+    /**
+     * The name of the kind of expression model that the evaluator is specialised for.
+     */
+    const char* get_expression_model_name() const
+    {
+        return evaluator ? evaluator->get_expression_model_name() : expression_models::NoExpressions::name();
+    };
+
+private:
+    std::unique_ptr<detail::ModelEvaluatorInterface> evaluator; // empty until set_model() is called
+    ThreadPool* thread_pool = nullptr;
+    std::array<bool, 3> dirty{{true, true, true}}; // shp, exp, col
+    Eigen::VectorXf empty_instance;
+};
+
+/**
+ * Checks that evaluating a model does not read the basis columns whose coefficients are zero, as the
+ * viewer relies on this to keep the columns of a memory-mapped model container on disk. The columns
+ * beyond the first \p num_used_components of a small model are filled with NaN, which would turn up
+ * in the instances if they were read. Writes the result to \p out.
+ *
+ * @param[in] out The stream to write the result to.
+ * @param[in] num_used_components The number of columns whose coefficients are set.
+ * @return Whether the check passed.
+ */
+inline bool validate_lazy_evaluation(std::ostream& out, int num_used_components = 30)
+{
+    const int num_vertices = 100;
+    const int data_dimension = 3 * num_vertices;
+    const int num_components = num_used_components + 10;
+    std::vector<float> mean(data_dimension, 1.0f);
+    std::vector<float> eigenvalues(num_components, 1.0f);
+    std::vector<float> basis(static_cast<std::size_t>(data_dimension) * num_components);
+    for (std::size_t i = 0; i < basis.size(); ++i)
+    {
+        basis[i] = static_cast<int>(i / data_dimension) < num_used_components
+                       ? static_cast<float>(i % 7) * 0.125f
+                       : std::numeric_limits<float>::quiet_NaN();
+    }
+
+    PcaModelView pca_model;
+    pca_model.mean = mean.data();
+    pca_model.rescaled_pca_basis = basis.data();
+    pca_model.eigenvalues = eigenvalues.data();
+    pca_model.data_dimension = data_dimension;
+    pca_model.num_principal_components = num_components;
+
+    ModelView model;
+    model.shape_model = pca_model;
+    model.color_model = pca_model;
+    model.expression_model_type = ExpressionModelType::Blendshapes;
+    model.blendshapes = basis.data();
+    model.num_blendshapes = num_components;
+
+    // All-zero coefficients first, then the ones of the used columns set, both full length:
+    std::vector<float> coefficients(num_components, 0.0f);
+    bool passed = true;
+    ModelEvaluator evaluator;
+    evaluator.set_model(model);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        evaluator.mark_all_dirty();
+        evaluator.update(coefficients, coefficients, coefficients, true);
+        passed = passed && evaluator.get_shape_instance().allFinite() &&
+                 evaluator.get_color_instance().allFinite();
+        std::fill(coefficients.begin(), coefficients.begin() + num_used_components, 0.5f);
+    }
+    out << "lazy evaluation: " << (passed ? "passed" : "FAILED") << std::endl;
+    return passed;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_MODELEVALUATOR_HPP */
@@ -0,0 +1,189 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: ModelLoaderRegistry.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_MODELLOADERREGISTRY_HPP
+#define EOSVIEWER_MODELLOADERREGISTRY_HPP
+
+#include "LoadedModel.hpp"
+#include "LoadProgress.hpp"
+#include "model_container.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * Options for loading a model, which each loader uses as far as its format allows.
+ */
+struct ModelLoadOptions
+{
+    int num_resident_components = -1; // see load_model_container(); -1 reads the whole model
+    ThreadPool* thread_pool = nullptr; // if given, independent parts of a file are loaded in parallel
+};
+
+/**
+ * A loader for one model file format.
+ */
+struct ModelLoader
+{
+    using SniffFunction = std::function<bool(const unsigned char* data, std::size_t size)>;
+    using LoadFunction =
+        std::function<LoadedModel(const std::string& filename, const ModelLoadOptions&, LoadProgress&)>;
+
+    std::string name;
+    // Returns whether the given first bytes of a file are in this format. Empty for formats without
+    // magic bytes, which are recognised by their extension only:
+    SniffFunction sniff;
+    std::vector<std::string> extensions; // in lower case, without the dot
+    LoadFunction load;
+    bool loads_in_place = false; // whether the file is used in place, so converting it wouldn't help
+};
+
+/**
+ * Returns the extension of the last component of the given path, in lower case, without the dot, or
+ * an empty string if it has none. Dots in directory names are ignored.
+ */
+inline std::string get_extension(const std::string& filename)
+{
+    const auto last_separator = filename.find_last_of("/\\");
+    const auto last_dot = filename.find_last_of('.');
+    if (last_dot == std::string::npos || (last_separator != std::string::npos && last_dot < last_separator))
+    {
+        return std::string();
+    }
+    auto extension = filename.substr(last_dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension;
+};
+
+/**
+ * A list of model loaders, which finds the right one for a file.
+ *
+ * A file is first matched by its content: the first bytes of the file are given to the sniff
+ * functions of the loaders, in the order the loaders have been added. If none of them recognises the
+ * file, it is matched by its extension. So a model container is recognised even if it has been
+ * renamed, and formats that have no magic bytes still work.
+ */
+class ModelLoaderRegistry
+{
+public:
+    // The number of bytes at the start of a file that are given to the sniff functions:
+    static const std::size_t sniff_size = 64;
+
+    void add(ModelLoader loader)
+    {
+        loaders.push_back(std::move(loader));
+    };
+
+    /**
+     * Finds the loader for the given file.
+     *
+     * @param[in] filename The model file.
+     * @return The loader for the file's format.
+     * @throw std::runtime_error if the file can't be opened, or no loader recognises it.
+     */
+    const ModelLoader& find(const std::string& filename) const
+    {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error("Error opening file: " + filename);
+        }
+        unsigned char header[sniff_size];
+        file.read(reinterpret_cast<char*>(header), sniff_size);
+        const auto header_size = static_cast<std::size_t>(file.gcount());
+        for (const auto& loader : loaders)
+        {
+            if (loader.sniff && loader.sniff(header, header_size))
+            {
+                return loader;
+            }
+        }
+        const auto extension = get_extension(filename);
+        for (const auto& loader : loaders)
+        {
+            if (std::find(loader.extensions.begin(), loader.extensions.end(), extension) !=
+                loader.extensions.end())
+            {
+                return loader;
+            }
+        }
+        throw std::runtime_error("Error: The format of " + filename +
+                                 " is unknown. Please load a model with " + get_supported_extensions() +
+                                 " extension.");
+    };
+
+    /**
+     * Returns the extensions of all the loaders, for messages, e.g. ".eosm, .bin or .scm".
+     */
+    std::string get_supported_extensions() const
+    {
+        std::vector<std::string> extensions;
+        for (const auto& loader : loaders)
+        {
+            for (const auto& extension : loader.extensions)
+            {
+                extensions.push_back("." + extension);
+            }
+        }
+        std::string list;
+        for (std::size_t i = 0; i < extensions.size(); ++i)
+        {
+            list += (i == 0 ? "" : (i + 1 == extensions.size() ? " or " : ", ")) + extensions[i];
+        }
+        return list;
+    };
+
+private:
+    std::vector<ModelLoader> loaders;
+};
+
+/**
+ * Returns the loader for native model containers (.eosm), which recognises them by their magic bytes,
+ * and maps and validates their sections in parallel on the pool of the options.
+ */
+inline ModelLoader make_model_container_loader()
+{
+    ModelLoader loader;
+    loader.name = "eos model container";
+    loader.sniff = container::has_magic;
+    loader.extensions = {"eosm"};
+    loader.load = [](const std::string& filename, const ModelLoadOptions& options, LoadProgress& progress) {
+        return load_model_container(filename, &progress, options.num_resident_components,
+                                    options.thread_pool);
+    };
+    loader.loads_in_place = true;
+    return loader;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_MODELLOADERREGISTRY_HPP */
@@ -0,0 +1,228 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: ModelView.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_MODELVIEW_HPP
+#define EOSVIEWER_MODELVIEW_HPP
+
+#include "BasisView.hpp"
+
+#include "eos/morphablemodel/PcaModel.hpp"
+
+#include "Eigen/Core"
+
+#include <string>
+#include <vector>
+
+namespace eosviewer {
+
+using ConstVectorMap = Eigen::Map<const Eigen::VectorXf>;
+using ConstMatrixMap = Eigen::Map<const Eigen::MatrixXf>;
+using ConstTriangleMap = Eigen::Map<const Eigen::Matrix<int, Eigen::Dynamic, 3, Eigen::RowMajor>>;
+using ConstTextureCoordinateMap = Eigen::Map<const Eigen::Matrix<float, Eigen::Dynamic, 2, Eigen::RowMajor>>;
+
+/**
+ * A non-owning view on the data of a PCA model that the viewer evaluates: the mean, the rescaled
+ * basis (data_dimension x num_principal_components, column-major) and the eigenvalues.
+ *
+ * The data can live in a PcaModel, or in a memory-mapped model container, and is used in place via
+ * Eigen::Map. The basis may be stored in a lower precision, see BasisView. The accessors are named
+ * like PcaModel's. Whoever creates the view has to keep the data alive, see LoadedModel.
+ */
+struct PcaModelView
+{
+    const float* mean = nullptr;
+    const void* rescaled_pca_basis = nullptr; // in basis_precision
+    const float* basis_column_scales = nullptr; // if basis_precision is Int8
+    BasisPrecision basis_precision = BasisPrecision::Float32;
+    const float* eigenvalues = nullptr;
+    int data_dimension = 0;
+    int num_principal_components = 0;
+
+    int get_data_dimension() const
+    {
+        return data_dimension;
+    };
+
+    int get_num_principal_components() const
+    {
+        return num_principal_components;
+    };
+
+    ConstVectorMap get_mean() const
+    {
+        return ConstVectorMap(mean, data_dimension);
+    };
+
+    BasisView get_rescaled_pca_basis() const
+    {
+        BasisView basis;
+        basis.data = rescaled_pca_basis;
+        basis.column_scales = basis_column_scales;
+        basis.precision = basis_precision;
+        basis.rows = data_dimension;
+        basis.cols = num_principal_components;
+        return basis;
+    };
+
+    ConstVectorMap get_eigenvalues() const
+    {
+        return ConstVectorMap(eigenvalues, num_principal_components);
+    };
+};
+
+/**
+ * Creates a view on the given PCA model, which has to outlive the view.
+ */
+inline PcaModelView make_view(const eos::morphablemodel::PcaModel& pca_model)
+{
+    PcaModelView view;
+    view.mean = pca_model.get_mean().data();
+    view.rescaled_pca_basis = pca_model.get_rescaled_pca_basis().data();
+    view.eigenvalues = pca_model.get_eigenvalues().data();
+    view.data_dimension = static_cast<int>(pca_model.get_mean().size());
+    view.num_principal_components = pca_model.get_num_principal_components();
+    return view;
+};
+
+/**
+ * A landmark of a Morphable Model: its name (e.g. "37" or "right.eye.corner_outer") and the vertex it is
+ * defined on.
+ */
+struct LandmarkDefinition
+{
+    std::string name;
+    int vertex_index;
+};
+
+/**
+ * The kind of expression model a Morphable Model has, if any.
+ */
+enum class ExpressionModelType { None, PcaModel, Blendshapes };
+
+/**
+ * A non-owning view on everything of a Morphable Model that the viewer needs: the shape and colour
+ * PCA models, the expression model (a PCA model, or blendshapes packed into a data_dimension x
+ * num_blendshapes column-major matrix, in any BasisPrecision), the triangle list (num_triangles x 3,
+ * row-major), the texture coordinates (num_vertices x 2, row-major, possibly empty) and the landmark
+ * definitions (possibly none).
+ *
+ * Views are cheap to copy. See LoadedModel for a view together with the storage it points to.
+ */
+struct ModelView
+{
+    PcaModelView shape_model;
+    PcaModelView color_model; // num_principal_components is 0 if the model has no colour model
+    ExpressionModelType expression_model_type = ExpressionModelType::None;
+    PcaModelView expression_pca_model; // if expression_model_type is PcaModel
+    const void* blendshapes = nullptr;  // if expression_model_type is Blendshapes
+    const float* blendshapes_column_scales = nullptr; // if blendshapes_precision is Int8
+    BasisPrecision blendshapes_precision = BasisPrecision::Float32;
+    int num_blendshapes = 0;
+    SparseBasisView sparse_blendshapes; // the blendshapes again, if sparse, see SparseBlendshapes.hpp
+    const int* triangles = nullptr;
+    int num_triangles = 0;
+    const float* texture_coordinates = nullptr;
+    int num_texture_coordinates = 0;
+    const int* landmark_vertices = nullptr; // the vertex of each landmark
+    const char* landmark_names = nullptr;   // the name of each landmark, '\0'-terminated, one after another
+    int num_landmarks = 0;
+    int landmark_names_size = 0; // in bytes, including the terminators
+
+    const PcaModelView& get_shape_model() const
+    {
+        return shape_model;
+    };
+
+    const PcaModelView& get_color_model() const
+    {
+        return color_model;
+    };
+
+    bool has_separate_expression_model() const
+    {
+        return expression_model_type != ExpressionModelType::None;
+    };
+
+    /**
+     * The number of expression coefficients, i.e. of principal components or blendshapes.
+     */
+    int get_num_expression_coefficients() const
+    {
+        switch (expression_model_type)
+        {
+        case ExpressionModelType::PcaModel:
+            return expression_pca_model.get_num_principal_components();
+        case ExpressionModelType::Blendshapes:
+            return num_blendshapes;
+        default:
+            return 0;
+        }
+    };
+
+    /**
+     * The expression basis: the rescaled PCA basis of the expression model, or the packed blendshapes.
+     */
+    BasisView get_expression_basis() const
+    {
+        if (expression_model_type == ExpressionModelType::PcaModel)
+        {
+            return expression_pca_model.get_rescaled_pca_basis();
+        }
+        BasisView basis;
+        basis.data = blendshapes;
+        basis.column_scales = blendshapes_column_scales;
+        basis.precision = blendshapes_precision;
+        basis.rows = blendshapes ? shape_model.get_data_dimension() : 0;
+        basis.cols = num_blendshapes;
+        return basis;
+    };
+
+    ConstTriangleMap get_triangles() const
+    {
+        return ConstTriangleMap(triangles, num_triangles, 3);
+    };
+
+    ConstTextureCoordinateMap get_texture_coordinates() const
+    {
+        return ConstTextureCoordinateMap(texture_coordinates, num_texture_coordinates, 2);
+    };
+
+    /**
+     * The landmark definitions of the model, in the order in which they are stored. This copies the
+     * names, so it is meant to be called once after a model has been loaded, and not per frame.
+     */
+    std::vector<LandmarkDefinition> get_landmark_definitions() const
+    {
+        std::vector<LandmarkDefinition> landmarks;
+        landmarks.reserve(num_landmarks);
+        const char* name = landmark_names;
+        for (int i = 0; i < num_landmarks; ++i)
+        {
+            landmarks.push_back({name, landmark_vertices[i]});
+            name += landmarks.back().name.size() + 1;
+        }
+        return landmarks;
+    };
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_MODELVIEW_HPP */
@@ -0,0 +1,110 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: PackedBlendshapes.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_PACKEDBLENDSHAPES_HPP
+#define EOSVIEWER_PACKEDBLENDSHAPES_HPP
+
+#include "eos/morphablemodel/Blendshape.hpp"
+
+#include "Eigen/Core"
+
+#include <cstddef>
+#include <stdexcept>
+
+namespace eosviewer {
+
+/**
+ * Blendshapes packed into one contiguous, column-major matrix of size
+ * data_dimension x num_blendshapes, with one blendshape per column.
+ *
+ * morphablemodel::Blendshapes stores each deformation in its own allocation, so adding
+ * them up one by one walks N separate vectors and makes N passes over the output. With
+ * the packed matrix, the expression part is a single matrix-vector product.
+ */
+class PackedBlendshapes
+{
+public:
+    PackedBlendshapes() = default;
+
+    /**
+     * Packs the given blendshapes. This copies all the deformations, so it should be done
+     * once, when the blendshapes are loaded.
+     *
+     * @param[in] blendshapes The blendshapes to pack. All must have the same dimension.
+     */
+    explicit PackedBlendshapes(const eos::morphablemodel::Blendshapes& blendshapes)
+    {
+        if (!blendshapes.empty())
+        {
+            deformations = eos::morphablemodel::to_matrix(blendshapes);
+        }
+    };
+
+    /**
+     * Packs the given blendshapes, and releases each deformation as soon as it has been copied, so
+     * that the blendshapes are only in memory once, plus one deformation, while they are packed.
+     *
+     * @param[in] blendshapes The blendshapes to pack. Their deformations are left empty.
+     * @throw std::runtime_error if the blendshapes don't all have the same dimension.
+     */
+    explicit PackedBlendshapes(eos::morphablemodel::Blendshapes&& blendshapes)
+    {
+        if (blendshapes.empty())
+        {
+            return;
+        }
+        deformations.resize(blendshapes[0].deformation.size(), blendshapes.size());
+        for (std::size_t i = 0; i < blendshapes.size(); ++i)
+        {
+            if (blendshapes[i].deformation.size() != deformations.rows())
+            {
+                throw std::runtime_error("The blendshapes do not all have the same dimension.");
+            }
+            deformations.col(i) = blendshapes[i].deformation;
+            blendshapes[i].deformation = Eigen::VectorXf();
+        }
+    };
+
+    int get_num_blendshapes() const
+    {
+        return static_cast<int>(deformations.cols());
+    };
+
+    int get_data_dimension() const
+    {
+        return static_cast<int>(deformations.rows());
+    };
+
+    /**
+     * The packed deformations, one blendshape per column.
+     */
+    const Eigen::MatrixXf& get_deformations() const
+    {
+        return deformations;
+    };
+
+private:
+    Eigen::MatrixXf deformations;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_PACKEDBLENDSHAPES_HPP */
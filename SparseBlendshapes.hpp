@@ -0,0 +1,201 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: SparseBlendshapes.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_SPARSEBLENDSHAPES_HPP
+#define EOSVIEWER_SPARSEBLENDSHAPES_HPP
+
+#include "BasisView.hpp"
+#include "LoadedModel.hpp"
+#include "ModelView.hpp"
+#include "tiled_kernels.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * A vertex counts as not displaced by a blendshape if all its coordinates are at most this times the
+ * largest absolute value of the blendshape.
+ */
+const float default_sparse_tolerance = 1e-5f;
+
+/**
+ * Blendshapes are only evaluated sparse if at most this fraction of their values is stored. Above it,
+ * the dense kernels, which stream the whole matrix without any indexing, are faster.
+ */
+const double max_sparse_density = 0.5;
+
+/**
+ * Two ranges of displaced vertices that are at most this many vertices apart are stored as one block,
+ * so that the blocks are long enough for the SIMD kernels, and the number of blocks stays small.
+ */
+const int max_sparse_gap_vertices = 8;
+
+/**
+ * A sparse basis with its storage, see SparseBasisView.
+ */
+struct SparseBasis
+{
+    std::vector<RowBlock> blocks;
+    std::vector<int> column_blocks;
+    std::vector<float> values;
+    int rows = 0;
+    int cols = 0;
+
+    SparseBasisView get_view() const
+    {
+        SparseBasisView view;
+        view.blocks = blocks.data();
+        view.column_blocks = column_blocks.data();
+        view.values = values.data();
+        view.rows = rows;
+        view.cols = cols;
+        return view;
+    };
+
+    /**
+     * The fraction of the values of the dense basis that are stored.
+     */
+    double get_density() const
+    {
+        const auto num_values = static_cast<double>(rows) * cols;
+        return num_values == 0.0 ? 0.0 : values.size() / num_values;
+    };
+};
+
+/**
+ * Finds the vertices that each column of a basis of vertex displacements (x_0, y_0, z_0, x_1, ...)
+ * moves, and stores each column as blocks of consecutive displaced vertices. The values are stored as
+ * float, whatever the precision of the basis is. The values of vertices that aren't displaced are
+ * dropped, the others are kept exactly.
+ *
+ * @param[in] basis The basis, with 3 rows per vertex.
+ * @param[in] relative_tolerance A vertex isn't displaced if all its coordinates are at most this times
+ *                               the largest absolute value of the column.
+ * @return The sparse basis.
+ */
+inline SparseBasis make_sparse_basis(const BasisView& basis,
+                                     float relative_tolerance = default_sparse_tolerance)
+{
+    SparseBasis sparse;
+    sparse.rows = basis.rows;
+    sparse.cols = basis.cols;
+    sparse.column_blocks.reserve(basis.cols + 1);
+    sparse.column_blocks.push_back(0);
+    const int num_vertices = basis.rows / 3;
+    std::vector<float> column(basis.rows);
+    for (int col = 0; col < basis.cols; ++col)
+    {
+        // Adding a column to zeros gives exactly the dequantized column:
+        std::fill(begin(column), end(column), 0.0f);
+        kernels::axpy(nullptr, 1.0f, basis, col, column.data());
+        float max_abs = 0.0f;
+        for (const auto value : column)
+        {
+            max_abs = std::max(max_abs, std::abs(value));
+        }
+        const float threshold = relative_tolerance * max_abs;
+        const auto is_displaced = [&](int vertex) {
+            return std::abs(column[3 * vertex]) > threshold ||
+                   std::abs(column[3 * vertex + 1]) > threshold ||
+                   std::abs(column[3 * vertex + 2]) > threshold;
+        };
+        int vertex = 0;
+        while (vertex < num_vertices)
+        {
+            if (!is_displaced(vertex))
+            {
+                ++vertex;
+                continue;
+            }
+            // Extend the block until there are more than max_sparse_gap_vertices undisplaced vertices:
+            const int first_vertex = vertex;
+            int end_vertex = vertex + 1;
+            for (vertex = end_vertex; vertex < num_vertices && vertex - end_vertex < max_sparse_gap_vertices;
+                 ++vertex)
+            {
+                if (is_displaced(vertex))
+                {
+                    end_vertex = vertex + 1;
+                }
+            }
+            vertex = end_vertex;
+            const RowBlock block{3 * first_vertex, 3 * (end_vertex - first_vertex),
+                                 static_cast<std::ptrdiff_t>(sparse.values.size())};
+            sparse.blocks.push_back(block);
+            sparse.values.insert(end(sparse.values), begin(column) + block.first_row,
+                                 begin(column) + block.first_row + block.num_rows);
+        }
+        sparse.column_blocks.push_back(static_cast<int>(sparse.blocks.size()));
+    }
+    return sparse;
+};
+
+/**
+ * If the given model has blendshapes that only displace a small part of the vertices each (at most
+ * max_sparse_density of the values), returns the model with a sparse copy of them (see
+ * make_sparse_basis()), which the evaluation then uses instead of the dense ones. Otherwise, the model
+ * is returned as it is. The storage of the given model is shared.
+ *
+ * This reads all the blendshapes, so of a model container that is only partly resident, it reads
+ * the rest of the blendshapes.
+ *
+ * @param[in] model A loaded model.
+ * @param[out] density If given, the fraction of the values of the blendshapes that are non-zero, or 1
+ *                     if the model has no blendshapes.
+ * @return The model with sparse blendshapes, if they are sparse enough.
+ */
+inline LoadedModel with_sparse_blendshapes(const LoadedModel& model, double* density = nullptr)
+{
+    trace::Span span("make blendshapes sparse");
+    if (density)
+    {
+        *density = 1.0;
+    }
+    if (model.view.expression_model_type != ExpressionModelType::Blendshapes ||
+        model.view.num_blendshapes == 0)
+    {
+        return model;
+    }
+    auto sparse_blendshapes =
+        std::make_shared<SparseBasis>(make_sparse_basis(model.view.get_expression_basis()));
+    if (density)
+    {
+        *density = sparse_blendshapes->get_density();
+    }
+    if (sparse_blendshapes->get_density() > max_sparse_density)
+    {
+        return model;
+    }
+    LoadedModel result = model;
+    result.view.sparse_blendshapes = sparse_blendshapes->get_view();
+    result.sparse_blendshapes_storage = std::move(sparse_blendshapes);
+    return result;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_SPARSEBLENDSHAPES_HPP */
@@ -0,0 +1,242 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: StageProfiler.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_STAGEPROFILER_HPP
+#define EOSVIEWER_STAGEPROFILER_HPP
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * Records the time that each stage of a frame (or of anything else that repeats) takes, for the last
+ * history_length times it has run, and computes the min, average, 99th percentile and max over these.
+ * If tracing is enabled, the stages are recorded as spans of the trace as well (see trace.hpp).
+ *
+ * The stages are added once, at the start, with add_stage(). Times can then be recorded from any
+ * thread, e.g. with ScopedStageTimer, and recording doesn't allocate. The statistics are computed on
+ * request, over a copy of the history, so the profiler doesn't do any work per frame that isn't
+ * looked at.
+ */
+class StageProfiler
+{
+public:
+    using clock = trace::clock;
+
+    /**
+     * Statistics of the recorded times of a stage, in milliseconds.
+     */
+    struct StageStatistics
+    {
+        int num_samples = 0;
+        double min = 0.0;
+        double average = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+        double last = 0.0;
+    };
+
+    /**
+     * @param[in] history_length The number of times per stage that are kept.
+     */
+    explicit StageProfiler(std::size_t history_length = 300) : history_length(history_length){};
+
+    /**
+     * Adds a stage. This is not thread-safe, all stages have to be added before times are recorded.
+     *
+     * @param[in] name The name of the stage.
+     * @return The index of the stage, to record its times with.
+     */
+    int add_stage(std::string name)
+    {
+        Stage stage;
+        stage.name = std::move(name);
+        stage.trace_name = trace::intern(stage.name);
+        stage.times.resize(history_length);
+        stages.push_back(std::move(stage));
+        scratch.reserve(history_length);
+        return static_cast<int>(stages.size()) - 1;
+    };
+
+    int get_num_stages() const
+    {
+        return static_cast<int>(stages.size());
+    };
+
+    const std::string& get_stage_name(int stage) const
+    {
+        return stages[stage].name;
+    };
+
+    /**
+     * Records a time of the given stage, replacing the oldest one if the history is full. Thread-safe.
+     */
+    void record(int stage, clock::duration time)
+    {
+        const float milliseconds = std::chrono::duration<float, std::milli>(time).count();
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& history = stages[stage];
+        history.times[history.num_recorded % history_length] = milliseconds;
+        ++history.num_recorded;
+    };
+
+    /**
+     * Copies the recorded times of a stage, in milliseconds and oldest first, into the given vector.
+     * Doesn't allocate once the vector has had the size of the history.
+     */
+    void get_history(int stage, std::vector<float>& times) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        copy_history(stages[stage], times);
+    };
+
+    /**
+     * Records a time of the given stage, from start to end, and adds it to the trace, as span of the
+     * calling thread, if tracing is enabled. Thread-safe.
+     */
+    void record(int stage, clock::time_point start, clock::time_point end)
+    {
+        record(stage, end - start);
+        trace::add_span(stages[stage].trace_name, start, end);
+    };
+
+    /**
+     * Computes the statistics of the recorded times of a stage.
+     */
+    StageStatistics get_statistics(int stage) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        copy_history(stages[stage], scratch);
+        StageStatistics statistics;
+        if (scratch.empty())
+        {
+            return statistics;
+        }
+        statistics.num_samples = static_cast<int>(scratch.size());
+        statistics.last = scratch.back();
+        double sum = 0.0;
+        for (const auto time : scratch)
+        {
+            sum += time;
+        }
+        statistics.average = sum / scratch.size();
+        const auto minmax = std::minmax_element(begin(scratch), end(scratch));
+        statistics.min = *minmax.first;
+        statistics.max = *minmax.second;
+        // The smallest time that at least 99% of the times are lower than or equal to:
+        const auto p99 = begin(scratch) + static_cast<std::ptrdiff_t>(std::ceil(0.99 * scratch.size())) - 1;
+        std::nth_element(begin(scratch), p99, end(scratch));
+        statistics.p99 = *p99;
+        return statistics;
+    };
+
+    /**
+     * Writes the recorded times of all stages to a CSV file, with the columns stage, sample (0 is the
+     * oldest recorded time that is kept) and milliseconds, and one row per time.
+     *
+     * @param[in] filename The file to write.
+     * @throw std::runtime_error if the file can't be written.
+     */
+    void write_csv(const std::string& filename) const
+    {
+        std::ofstream file(filename);
+        if (!file)
+        {
+            throw std::runtime_error("Error opening file for writing: " + filename);
+        }
+        file << "stage,sample,milliseconds\n";
+        std::vector<float> times;
+        for (int stage = 0; stage < get_num_stages(); ++stage)
+        {
+            get_history(stage, times);
+            for (std::size_t i = 0; i < times.size(); ++i)
+            {
+                file << stages[stage].name << "," << i << "," << times[i] << "\n";
+            }
+        }
+        if (!file)
+        {
+            throw std::runtime_error("Error writing file: " + filename);
+        }
+    };
+
+private:
+    struct Stage
+    {
+        std::string name;
+        const char* trace_name; // the name, copied into the trace, which may outlive the profiler
+        std::vector<float> times; // a ring buffer of history_length times, in milliseconds
+        std::size_t num_recorded = 0;
+    };
+
+    std::size_t history_length;
+    std::vector<Stage> stages;
+    mutable std::mutex mutex;
+    mutable std::vector<float> scratch; // for get_statistics(), guarded by the mutex
+
+    void copy_history(const Stage& stage, std::vector<float>& times) const
+    {
+        const auto num_times = std::min(stage.num_recorded, history_length);
+        const auto first = stage.num_recorded - num_times;
+        times.resize(num_times);
+        for (std::size_t i = 0; i < num_times; ++i)
+        {
+            times[i] = stage.times[(first + i) % history_length];
+        }
+    };
+};
+
+/**
+ * Records the time from its construction to its destruction as a time of a stage of a StageProfiler.
+ */
+class ScopedStageTimer
+{
+public:
+    ScopedStageTimer(StageProfiler& profiler, int stage)
+        : profiler(profiler), stage(stage), start(StageProfiler::clock::now()){};
+
+    ~ScopedStageTimer()
+    {
+        profiler.record(stage, start, StageProfiler::clock::now());
+    };
+
+    ScopedStageTimer(const ScopedStageTimer&) = delete;
+    ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+private:
+    StageProfiler& profiler;
+    int stage;
+    StageProfiler::clock::time_point start;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_STAGEPROFILER_HPP */
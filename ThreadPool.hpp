@@ -0,0 +1,211 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: ThreadPool.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_THREADPOOL_HPP
+#define EOSVIEWER_THREADPOOL_HPP
+
+#include "trace.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * A pool of persistent worker threads that runs parallel loops.
+ *
+ * parallel_for() hands out the task indices dynamically to the workers and to the calling
+ * thread, and returns when all tasks are done. The threads are started once, so a parallel
+ * loop costs a wake-up and not a thread creation. Running a loop does not allocate.
+ *
+ * Loops started from different threads are run one after the other.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * Creates a pool that runs loops on num_threads threads in total, i.e. the calling thread
+     * and num_threads - 1 workers.
+     *
+     * @param[in] num_threads Number of threads. 0 uses the number of hardware threads.
+     */
+    explicit ThreadPool(int num_threads = 0)
+    {
+        if (num_threads <= 0)
+        {
+            num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+        for (int i = 1; i < num_threads; ++i)
+        {
+            workers.emplace_back([this]() { worker_loop(); });
+        }
+    };
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        work_available.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    };
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int get_num_threads() const
+    {
+        return static_cast<int>(workers.size()) + 1;
+    };
+
+    /**
+     * Calls task(i) for every i in [0, num_tasks), in parallel, and waits until all calls
+     * have returned. The calling thread takes part in the work.
+     *
+     * @param[in] num_tasks The number of tasks.
+     * @param[in] task A callable taking the task index as std::ptrdiff_t.
+     */
+    template <class Task>
+    void parallel_for(std::ptrdiff_t num_tasks, Task&& task)
+    {
+        if (workers.empty() || num_tasks <= 1)
+        {
+            for (std::ptrdiff_t i = 0; i < num_tasks; ++i)
+            {
+                task(i);
+            }
+            return;
+        }
+        using TaskType = typename std::remove_reference<Task>::type;
+        run([](void* context, std::ptrdiff_t i) { (*static_cast<TaskType*>(context))(i); },
+            const_cast<void*>(static_cast<const void*>(&task)), num_tasks);
+    };
+
+private:
+    using TaskFunction = void (*)(void* context, std::ptrdiff_t index);
+
+    std::vector<std::thread> workers;
+
+    std::mutex run_mutex; // serialises loops started from different threads
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+    bool stop = false;
+    std::uint64_t generation = 0; // incremented for each loop, so the workers know there's new work
+    int num_active_workers = 0;
+
+    // The loop that is currently running:
+    TaskFunction task_function = nullptr;
+    void* task_context = nullptr;
+    std::ptrdiff_t num_tasks = 0;
+    std::atomic<std::ptrdiff_t> next_task{0};
+
+    void run(TaskFunction function, void* context, std::ptrdiff_t count)
+    {
+        std::lock_guard<std::mutex> run_lock(run_mutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task_function = function;
+            task_context = context;
+            num_tasks = count;
+            next_task = 0;
+            num_active_workers = static_cast<int>(workers.size());
+            ++generation;
+        }
+        work_available.notify_all();
+        run_tasks(function, context, count);
+        std::unique_lock<std::mutex> lock(mutex);
+        work_done.wait(lock, [this]() { return num_active_workers == 0; });
+    };
+
+    void run_tasks(TaskFunction function, void* context, std::ptrdiff_t count)
+    {
+        for (std::ptrdiff_t i = next_task++; i < count; i = next_task++)
+        {
+            function(context, i);
+        }
+    };
+
+    void worker_loop()
+    {
+        trace::set_thread_name("thread pool worker");
+        std::uint64_t last_generation = 0;
+        while (true)
+        {
+            TaskFunction function;
+            void* context;
+            std::ptrdiff_t count;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                work_available.wait(lock, [&]() { return stop || generation != last_generation; });
+                if (stop)
+                {
+                    return;
+                }
+                last_generation = generation;
+                function = task_function;
+                context = task_context;
+                count = num_tasks;
+            }
+            run_tasks(function, context, count);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --num_active_workers;
+            }
+            work_done.notify_one();
+        }
+    };
+};
+
+/**
+ * Calls task(i) for every i in [0, num_tasks) like ThreadPool::parallel_for(), on the given pool, or, if
+ * it's nullptr, one after the other on the calling thread.
+ */
+template <class Task>
+void parallel_for(ThreadPool* thread_pool, std::ptrdiff_t num_tasks, Task&& task)
+{
+    if (thread_pool)
+    {
+        thread_pool->parallel_for(num_tasks, std::forward<Task>(task));
+    } else
+    {
+        for (std::ptrdiff_t i = 0; i < num_tasks; ++i)
+        {
+            task(i);
+        }
+    }
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_THREADPOOL_HPP */
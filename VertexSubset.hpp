@@ -0,0 +1,192 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: VertexSubset.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_VERTEXSUBSET_HPP
+#define EOSVIEWER_VERTEXSUBSET_HPP
+
+#include "BasisView.hpp"
+#include "LoadedModel.hpp"
+#include "ModelView.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace eosviewer {
+
+namespace detail {
+
+/**
+ * The storage of a model of a subset of the vertices of another model, see make_vertex_subset_model().
+ */
+struct VertexSubsetStorage
+{
+    struct PcaModel
+    {
+        std::vector<float> mean;
+        std::vector<float> basis;
+        std::vector<float> eigenvalues;
+    };
+    PcaModel shape_model;
+    PcaModel color_model;
+    PcaModel expression_pca_model;
+    std::vector<float> blendshapes;
+    std::vector<float> texture_coordinates;
+};
+
+/**
+ * Copies the rows 3 * v, 3 * v + 1 and 3 * v + 2 of each of the given vertices v out of a column-major
+ * basis, dequantized, into a column-major (3 * num_vertices) x cols matrix.
+ */
+inline std::vector<float> gather_vertex_rows(const BasisView& basis, const std::vector<int>& vertex_indices)
+{
+    const auto num_rows = 3 * vertex_indices.size();
+    std::vector<float> rows(num_rows * basis.cols);
+    for (int col = 0; col < basis.cols; ++col)
+    {
+        for (std::size_t i = 0; i < vertex_indices.size(); ++i)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                rows[col * num_rows + 3 * i + c] = basis.get_element(3 * vertex_indices[i] + c, col);
+            }
+        }
+    }
+    return rows;
+};
+
+} /* namespace detail */
+
+/**
+ * Returns a model of only the given vertices of a model: the rows of the means, bases and blendshapes
+ * that belong to these vertices are gathered into a compact float32 model, whose vertex i is vertex
+ * vertex_indices[i] of the given model. The eigenvalues are the same.
+ *
+ * The result is an ordinary model, so it is evaluated with the same functions (add_sample(),
+ * evaluate_batch(), ModelEvaluator), and with the same coefficients, as the full model, but only
+ * computes the given vertices. For a few vertices, e.g. the landmarks, that is a small fraction of the
+ * work, and the gathered bases fit into the cache. The rows of quantized bases are dequantized.
+ *
+ * The result has no triangles, as the vertices don't form a mesh, and no landmark definitions. It has its
+ * own storage, so the given model can be released afterwards.
+ *
+ * @param[in] model The model to take the vertices of.
+ * @param[in] vertex_indices The vertices to take, in the order of the result. May contain duplicates.
+ * @return The model of the vertices.
+ * @throw std::runtime_error if no vertices are given, or a vertex that the model doesn't have.
+ */
+inline LoadedModel make_vertex_subset_model(const ModelView& model, const std::vector<int>& vertex_indices)
+{
+    const int num_vertices = model.get_shape_model().get_data_dimension() / 3;
+    if (vertex_indices.empty())
+    {
+        throw std::runtime_error("A vertex subset needs at least one vertex.");
+    }
+    for (const auto vertex_index : vertex_indices)
+    {
+        if (vertex_index < 0 || vertex_index >= num_vertices)
+        {
+            throw std::runtime_error("The vertex subset contains the vertex " + std::to_string(vertex_index) +
+                                     ", which the model doesn't have.");
+        }
+    }
+    auto storage = std::make_shared<detail::VertexSubsetStorage>();
+    const int subset_dimension = 3 * static_cast<int>(vertex_indices.size());
+
+    // A mean is gathered like a basis with one column:
+    const auto gather_pca_model = [&](const PcaModelView& pca_model,
+                                      detail::VertexSubsetStorage::PcaModel& pca_storage) {
+        PcaModelView result;
+        if (!pca_model.mean)
+        {
+            return result;
+        }
+        BasisView mean;
+        mean.data = pca_model.mean;
+        mean.rows = pca_model.get_data_dimension();
+        mean.cols = 1;
+        pca_storage.mean = detail::gather_vertex_rows(mean, vertex_indices);
+        result.mean = pca_storage.mean.data();
+        result.data_dimension = subset_dimension;
+        if (pca_model.rescaled_pca_basis)
+        {
+            const auto eigenvalues = pca_model.get_eigenvalues();
+            pca_storage.eigenvalues.assign(eigenvalues.data(), eigenvalues.data() + eigenvalues.size());
+            pca_storage.basis =
+                detail::gather_vertex_rows(pca_model.get_rescaled_pca_basis(), vertex_indices);
+            result.rescaled_pca_basis = pca_storage.basis.data();
+            result.eigenvalues = pca_storage.eigenvalues.data();
+            result.num_principal_components = pca_model.get_num_principal_components();
+        }
+        return result;
+    };
+
+    LoadedModel result;
+    auto& view = result.view;
+    view.shape_model = gather_pca_model(model.shape_model, storage->shape_model);
+    view.color_model = gather_pca_model(model.color_model, storage->color_model);
+    view.expression_model_type = model.expression_model_type;
+    if (model.expression_model_type == ExpressionModelType::PcaModel)
+    {
+        view.expression_pca_model =
+            gather_pca_model(model.expression_pca_model, storage->expression_pca_model);
+    } else if (model.expression_model_type == ExpressionModelType::Blendshapes)
+    {
+        storage->blendshapes = detail::gather_vertex_rows(model.get_expression_basis(), vertex_indices);
+        view.blendshapes = storage->blendshapes.data();
+        view.num_blendshapes = model.num_blendshapes;
+    }
+    if (model.texture_coordinates && model.num_texture_coordinates == num_vertices)
+    {
+        const auto texture_coordinates = model.get_texture_coordinates();
+        storage->texture_coordinates.reserve(2 * vertex_indices.size());
+        for (const auto vertex_index : vertex_indices)
+        {
+            storage->texture_coordinates.push_back(texture_coordinates(vertex_index, 0));
+            storage->texture_coordinates.push_back(texture_coordinates(vertex_index, 1));
+        }
+        view.texture_coordinates = storage->texture_coordinates.data();
+        view.num_texture_coordinates = static_cast<int>(vertex_indices.size());
+    }
+    result.storage = std::move(storage);
+    return result;
+};
+
+/**
+ * Returns the vertices of the given landmarks, in the same order, e.g. to pass them to
+ * make_vertex_subset_model().
+ */
+inline std::vector<int> get_vertex_indices(const std::vector<LandmarkDefinition>& landmarks)
+{
+    std::vector<int> vertex_indices;
+    vertex_indices.reserve(landmarks.size());
+    for (const auto& landmark : landmarks)
+    {
+        vertex_indices.push_back(landmark.vertex_index);
+    }
+    return vertex_indices;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_VERTEXSUBSET_HPP */
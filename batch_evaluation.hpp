@@ -0,0 +1,154 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: batch_evaluation.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_BATCH_EVALUATION_HPP
+#define EOSVIEWER_BATCH_EVALUATION_HPP
+
+#include "ModelView.hpp"
+#include "tiled_kernels.hpp"
+#include "ThreadPool.hpp"
+
+#include "Eigen/Core"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace eosviewer {
+
+/**
+ * Adds a batch of samples of the given PCA model to the given instances, i.e. computes
+ * instances += mean * 1^T + basis * coefficients, with the rescaled PCA basis.
+ *
+ * This is add_sample() for B coefficient vectors at once. The product is a blocked matrix-matrix
+ * product, so the basis, which is by far the largest operand, is streamed from memory once per
+ * batch instead of once per sample. If the coefficients have fewer rows than principal components,
+ * the remaining ones are treated as zero.
+ *
+ * @param[in] pca_model The PCA model.
+ * @param[in] coefficients The K x B coefficients, one sample per column.
+ * @param[in,out] instances The D x B instances to add the samples to, D being the model's data dimension.
+ * @param[in] thread_pool If given, the vertices are processed in parallel on this pool.
+ */
+inline void add_samples(const PcaModelView& pca_model, const Eigen::MatrixXf& coefficients,
+                        Eigen::MatrixXf& instances, ThreadPool* thread_pool = nullptr)
+{
+    const auto basis = pca_model.get_rescaled_pca_basis();
+    const auto num_coefficients = std::min(coefficients.rows(), static_cast<Eigen::Index>(basis.cols));
+    instances.colwise() += pca_model.get_mean();
+    kernels::gemm_add(thread_pool, basis, num_coefficients, coefficients.data(), coefficients.rows(),
+                      coefficients.cols(), instances.data(), instances.rows());
+};
+
+/**
+ * Evaluates a batch of B instances of a Morphable Model at once.
+ *
+ * The shape instances are the shape model samples plus the expression samples (PCA model, or
+ * linear combination of the packed blendshapes), the colour instances the colour model samples.
+ * Each part is one matrix-matrix product, see add_samples(). The instances are resized if needed,
+ * so if they are kept around, evaluating batches of the same size does not allocate.
+ *
+ * @param[in] morphable_model The model to evaluate.
+ * @param[in] shape_coefficients The K_shp x B shape coefficients, one sample per column.
+ * @param[in] expression_coefficients The K_exp x B expression coefficients. May have 0 rows.
+ * @param[in] color_coefficients The K_col x B colour coefficients.
+ * @param[out] shape_instances The 3N x B shape instances.
+ * @param[out] color_instances The 3N x B colour instances (0 x B if the model has no colour).
+ * @param[in] thread_pool If given, the vertices are processed in parallel on this pool.
+ */
+inline void evaluate_batch(const ModelView& morphable_model, const Eigen::MatrixXf& shape_coefficients,
+                           const Eigen::MatrixXf& expression_coefficients,
+                           const Eigen::MatrixXf& color_coefficients, Eigen::MatrixXf& shape_instances,
+                           Eigen::MatrixXf& color_instances, ThreadPool* thread_pool = nullptr)
+{
+    const auto batch_size = shape_coefficients.cols();
+    const auto& shape_model = morphable_model.get_shape_model();
+    const auto& color_model = morphable_model.get_color_model();
+
+    shape_instances.setZero(shape_model.get_data_dimension(), batch_size);
+    add_samples(shape_model, shape_coefficients, shape_instances, thread_pool);
+    if (morphable_model.expression_model_type == ExpressionModelType::PcaModel)
+    {
+        add_samples(morphable_model.expression_pca_model, expression_coefficients, shape_instances,
+                    thread_pool);
+    } else if (morphable_model.expression_model_type == ExpressionModelType::Blendshapes)
+    {
+        const auto num_coefficients = std::min(expression_coefficients.rows(),
+                                               static_cast<Eigen::Index>(morphable_model.num_blendshapes));
+        if (!morphable_model.sparse_blendshapes.empty())
+        {
+            kernels::gemm_add(thread_pool, morphable_model.sparse_blendshapes, num_coefficients,
+                              expression_coefficients.data(), expression_coefficients.rows(), batch_size,
+                              shape_instances.data(), shape_instances.rows());
+        } else
+        {
+            kernels::gemm_add(thread_pool, morphable_model.get_expression_basis(), num_coefficients,
+                              expression_coefficients.data(), expression_coefficients.rows(), batch_size,
+                              shape_instances.data(), shape_instances.rows());
+        }
+    }
+    color_instances.setZero(color_model.get_data_dimension(), batch_size);
+    add_samples(color_model, color_coefficients, color_instances, thread_pool);
+};
+
+/**
+ * Returns the number of floating point operations of a call to evaluate_batch() with the given
+ * coefficients, counting a multiply-add as two. Like the evaluation, this only counts as many
+ * coefficients as each model has components. The additions of the means are not counted, and of
+ * sparse blendshapes, only the stored values are.
+ */
+inline std::int64_t count_batch_flops(const ModelView& morphable_model,
+                                      const Eigen::MatrixXf& shape_coefficients,
+                                      const Eigen::MatrixXf& expression_coefficients,
+                                      const Eigen::MatrixXf& color_coefficients)
+{
+    // The number of coefficients that evaluate_batch() uses, see add_samples():
+    const auto get_num_used = [](const Eigen::MatrixXf& coefficients, int num_components) -> std::int64_t {
+        return std::min(coefficients.rows(), static_cast<Eigen::Index>(num_components));
+    };
+    const auto& shape_model = morphable_model.get_shape_model();
+    const auto& color_model = morphable_model.get_color_model();
+    const std::int64_t shape_dimension = shape_model.get_data_dimension();
+    std::int64_t expression_multiply_adds = 0;
+    if (morphable_model.expression_model_type == ExpressionModelType::PcaModel)
+    {
+        const auto& expression_model = morphable_model.expression_pca_model;
+        expression_multiply_adds =
+            shape_dimension *
+            get_num_used(expression_coefficients, expression_model.get_num_principal_components());
+    } else if (morphable_model.expression_model_type == ExpressionModelType::Blendshapes)
+    {
+        const auto num_used = get_num_used(expression_coefficients, morphable_model.num_blendshapes);
+        const auto& sparse_blendshapes = morphable_model.sparse_blendshapes;
+        expression_multiply_adds = sparse_blendshapes.empty()
+                                       ? shape_dimension * num_used
+                                       : sparse_blendshapes.get_num_values(static_cast<int>(num_used));
+    }
+    const std::int64_t multiply_adds =
+        shape_dimension * get_num_used(shape_coefficients, shape_model.get_num_principal_components()) +
+        expression_multiply_adds +
+        color_model.get_data_dimension() *
+            get_num_used(color_coefficients, color_model.get_num_principal_components());
+    return 2 * multiply_adds * shape_coefficients.cols();
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_BATCH_EVALUATION_HPP */
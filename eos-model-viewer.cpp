@@ -18,14 +18,40 @@
  * limitations under the License.
  */
 #include "cxxopts.hpp"
+#include "AsyncModelLoader.hpp"
+#include "LoadedModel.hpp"
+#include "LoadProgress.hpp"
+#include "process_memory.hpp"
+#include "model_container.hpp"
+#include "ModelCache.hpp"
+#include "ModelLoaderRegistry.hpp"
+#include "ModelEvaluator.hpp"
+#include "AsyncModelEvaluator.hpp"
+#include "quantization.hpp"
+#include "SparseBlendshapes.hpp"
+#include "VertexSubset.hpp"
+#include "kernels.hpp"
+#include "ThreadPool.hpp"
+#include "viewer_buffers.hpp"
+#include "FrameArena.hpp"
+#include "CoefficientPanel.hpp"
+#include "FramePacer.hpp"
+#include "StageProfiler.hpp"
+#include "trace.hpp"
+#include "AllocationCounter.hpp"
+#include "random_sample.hpp"
+#include "headless.hpp"
 
 #include "eos/core/Mesh.hpp"
 #include "eos/morphablemodel/MorphableModel.hpp"
 #include "eos/morphablemodel/io/cvssp.hpp"
 #include "eos/morphablemodel/Blendshape.hpp"
+#include "eos/cpp17/optional.hpp"
 #include "eos/cpp17/variant.hpp"
 
 #include "igl/opengl/glfw/Viewer.h"
+#define GLFW_INCLUDE_NONE
+#include "GLFW/glfw3.h"
 #include "igl/opengl/glfw/imgui/ImGuiMenu.h"
 #include "igl/opengl/glfw/imgui/ImGuiHelpers.h"
 #include "imgui/imgui.h"
@@ -35,6 +61,8 @@
 #include <iomanip>
 #include <random>
 #include <algorithm>
+#include <chrono>
+#include <future>
 
 template <typename T>
 std::string to_string(const T a_value, const int n = 6)
@@ -44,78 +72,147 @@ std::string to_string(const T a_value, const int n = 6)
     return out.str();
 };
 
-// From: https://stackoverflow.com/a/1493195/1345959
-template <class ContainerType>
-void tokenize(const std::string& str, ContainerType& tokens, const std::string& delimiters = " ",
-              bool trim_empty = false)
+/**
+ * Loads a model stored as cereal BinaryArchive (.bin), as morphablemodel::load_model() does, but
+ * reports the bytes read. A cereal archive has no magic bytes, and has to be decoded in order.
+ */
+eosviewer::LoadedModel load_bin_model(const std::string& model_file, const eosviewer::ModelLoadOptions&,
+                                      eosviewer::LoadProgress& progress)
 {
-    std::string::size_type pos, last_pos = 0;
-    const auto length = str.length();
-
-    using value_type = typename ContainerType::value_type;
-    using size_type = typename ContainerType::size_type;
-
-    while (last_pos < length + 1)
-    {
-        pos = str.find_first_of(delimiters, last_pos);
-        if (pos == std::string::npos)
-        {
-            pos = length;
-        }
-
-        if (pos != last_pos || !trim_empty)
-            tokens.push_back(value_type(str.data() + last_pos, (size_type)pos - last_pos));
-
-        last_pos = pos + 1;
-    }
+    eos::morphablemodel::MorphableModel morphable_model;
+    eosviewer::load_binary_archive(model_file, morphable_model, progress);
+    return eosviewer::make_loaded_model(std::move(morphable_model));
 };
 
-eos::morphablemodel::MorphableModel load_bin_or_scm_model(std::string model_file)
+/**
+ * Loads a model in the Surrey .scm format.
+ */
+eosviewer::LoadedModel load_scm_model(const std::string& model_file, const eosviewer::ModelLoadOptions&,
+                                      eosviewer::LoadProgress& progress)
 {
-    using namespace eos;
-    using eos::morphablemodel::MorphableModel;
+    // The .scm loader reads the file on its own, so the whole file is one step of the progress:
+    progress.sections_total += 1;
+    eosviewer::trace::Span span("read .scm model");
+    auto morphable_model = eos::morphablemodel::load_scm_model(model_file);
+    progress.sections_decoded += 1;
+    return eosviewer::make_loaded_model(std::move(morphable_model));
+};
 
-    MorphableModel morphable_model;
+/**
+ * The loaders for all the model formats that the viewer can open.
+ */
+const eosviewer::ModelLoaderRegistry& get_model_loaders()
+{
+    static const eosviewer::ModelLoaderRegistry registry = []() {
+        eosviewer::ModelLoaderRegistry registry;
+        registry.add(eosviewer::make_model_container_loader());
+        eosviewer::ModelLoader bin_loader;
+        bin_loader.name = "cereal BinaryArchive";
+        bin_loader.extensions = {"bin"};
+        bin_loader.load = load_bin_model;
+        registry.add(bin_loader);
+        eosviewer::ModelLoader scm_loader;
+        scm_loader.name = "Surrey .scm";
+        scm_loader.extensions = {"scm"};
+        scm_loader.load = load_scm_model;
+        registry.add(scm_loader);
+        return registry;
+    }();
+    return registry;
+};
 
-    std::vector<std::string> tokens;
-    tokenize(model_file, tokens, ".");
-    const auto model_file_extension = tokens.back();
+/**
+ * Same as morphablemodel::load_blendshapes(), but reports the bytes read.
+ */
+eos::morphablemodel::Blendshapes load_blendshapes(std::string blendshapes_file,
+                                                   eosviewer::LoadProgress& progress)
+{
+    eos::morphablemodel::Blendshapes blendshapes;
+    eosviewer::load_binary_archive(blendshapes_file, blendshapes, progress);
+    return blendshapes;
+};
 
-    // Todo: Add try-catch to all these?
-    if (model_file_extension == "scm")
-    {
-        morphable_model = morphablemodel::load_scm_model(model_file);
-    } else if (model_file_extension == "bin")
-    {
-        morphable_model = morphablemodel::load_model(model_file);
-    } else
+/**
+ * Stores the blendshapes of the given model sparse as well, if they only displace a few vertices each
+ * (see with_sparse_blendshapes()), and reports whether they are.
+ */
+eosviewer::LoadedModel use_sparse_blendshapes(const eosviewer::LoadedModel& model)
+{
+    double density;
+    auto result = eosviewer::with_sparse_blendshapes(model, &density);
+    if (!result.view.sparse_blendshapes.empty())
     {
-        throw std::runtime_error("Error: Please load a model with .bin or .scm extension.");
+        std::cout << "Evaluating the blendshapes sparse, with " << density * 100.0
+                  << "% of the values of the dense matrix." << std::endl;
     }
-    return morphable_model;
-}
+    return result;
+};
 
 /**
+ * Loads a model from a native model container (.eosm), which is memory-mapped and used in place, or
+ * from a .bin or .scm file, and, if given, attaches the blendshapes. This is run on the loading thread
+ * of the viewer, and reports its progress. The format is detected by get_model_loaders(), and the
+ * independent parts of the files are loaded in parallel, on a thread pool of its own.
+ *
+ * The blendshapes file is read on a separate thread, at the same time as the model. The identity and
+ * colour models are then shared with the combined model, and not copied.
  *
+ * Of a model container, only the first num_resident_components components of each model are read
+ * before this returns, and the rest in the background (see load_model_container()). .bin and .scm
+ * files are always read completely, unless a cache directory is given: Then they are only parsed the
+ * first time, and afterwards loaded from a model container in the cache (see ModelCache.hpp).
+ *
+ * If a basis precision is given, the bases (and blendshapes) are converted to it after loading, see
+ * quantize_model(). This reads the whole model, and the cache always holds the model as it was loaded.
+ * If sparse_blendshapes is true, blendshapes that only displace a few vertices each are additionally
+ * stored and evaluated sparse, see with_sparse_blendshapes().
  */
-eos::morphablemodel::MorphableModel load_model(std::string model_file, std::string blendshapes_file)
+eosviewer::LoadedModel load_model(std::string model_file, std::string blendshapes_file,
+                                  eosviewer::LoadProgress& progress, int num_resident_components = -1,
+                                  std::string cache_directory = "",
+                                  eos::cpp17::optional<eosviewer::BasisPrecision> basis_precision = {},
+                                  bool sparse_blendshapes = true)
 {
     using namespace eos;
-    using eos::morphablemodel::MorphableModel;
-
-    MorphableModel morphable_model;
-
-    // Todo: Add try-catch to all these?
-    morphable_model = load_bin_or_scm_model(model_file);
-    // If separate blendshapes are given, load them, and construct a model with expressions:
-    if (!blendshapes_file.empty())
+    eosviewer::trace::Span span("load model");
+
+    const auto& loader = get_model_loaders().find(model_file);
+    eosviewer::ThreadPool thread_pool;
+    eosviewer::ModelLoadOptions options;
+    options.num_resident_components = num_resident_components;
+    options.thread_pool = &thread_pool;
+    const auto load_uncached = [&]() {
+        std::future<morphablemodel::Blendshapes> blendshapes;
+        if (!blendshapes_file.empty())
+        {
+            blendshapes = std::async(std::launch::async, [&blendshapes_file, &progress]() {
+                eosviewer::trace::set_thread_name("blendshapes loading");
+                return load_blendshapes(blendshapes_file, progress);
+            });
+        }
+        auto model = loader.load(model_file, options, progress);
+        // If separate blendshapes are given, construct a model with expressions:
+        if (blendshapes.valid())
+        {
+            model = eosviewer::with_blendshapes(model, blendshapes.get());
+        }
+        return model;
+    };
+    // A model container loads just as fast as a cache entry, so it isn't cached:
+    auto model = loader.loads_in_place || cache_directory.empty()
+                     ? load_uncached()
+                     : eosviewer::model_cache::load_cached_model(cache_directory, model_file,
+                                                                 blendshapes_file, load_uncached, progress,
+                                                                 options, std::cout);
+    if (basis_precision)
     {
-        const auto blendshapes = morphablemodel::load_blendshapes(blendshapes_file);
-        morphable_model = MorphableModel(
-            morphable_model.get_shape_model(), blendshapes, morphable_model.get_color_model(),
-            morphable_model.get_landmark_definitions(), morphable_model.get_texture_coordinates());
+        model = eosviewer::quantize_model(model.view, *basis_precision);
     }
-    return morphable_model;
+    if (sparse_blendshapes)
+    {
+        model = use_sparse_blendshapes(model);
+    }
+    return model;
 };
 
 /**
@@ -124,6 +221,8 @@ eos::morphablemodel::MorphableModel load_model(std::string model_file, std::stri
 int main(int argc, const char* argv[])
 {
     using namespace eos;
+    using eosviewer::ModelPart;
+    namespace kernels = eosviewer::kernels;
     using Eigen::VectorXf;
     using std::begin;
     using std::cout;
@@ -134,16 +233,99 @@ int main(int argc, const char* argv[])
     using std::vector;
 
     string model_file, blendshapes_file;
+    bool show_allocation_stats = false;
+    bool show_profiler = false;
+    double max_fps = 60.0;
+    string isa;
+    int num_threads = 0;
+    int num_resident_components = eosviewer::default_num_resident_components;
+    string cache_directory = eosviewer::model_cache::get_default_directory();
+    bool no_cache = false;
+    string convert_file;
+    string basis_precision_name;
+    cpp17::optional<eosviewer::BasisPrecision> basis_precision;
+    bool report_quantization_error = false;
+    bool dense_blendshapes = false;
+    bool benchmark_evaluation = false;
+    string trace_file;
+    bool headless = false;
+    bool headless_landmarks = false;
+    vector<int> headless_vertices;
+    eosviewer::HeadlessOptions headless_options;
     try
     {
         cxxopts::Options options("eos-model-viewer", "OpenGL viewer for eos's 3D morphable models.");
         // clang-format off
         options.add_options()
             ("h,help", "display the help message")
-            ("m,model", "an eos 3D Morphable Model stored as cereal BinaryArchive (.bin)",
+            ("m,model", "an eos 3D Morphable Model stored as cereal BinaryArchive (.bin), or as native model "
+                        "container (.eosm)",
                 cxxopts::value(model_file))
             ("b,blendshapes", "an eos file with blendshapes (.bin)",
-                cxxopts::value(blendshapes_file));
+                cxxopts::value(blendshapes_file))
+            ("alloc-stats", "show the number of heap allocations and allocated bytes per frame",
+                cxxopts::value(show_allocation_stats))
+            ("profile", "show the time each stage of a frame takes, over the last frames",
+                cxxopts::value(show_profiler))
+            ("max-fps", "maximum number of frames per second the viewer draws while it's interacted with or "
+                        "loading a model; when idle, it only draws on input (0: no limit)",
+                cxxopts::value(max_fps)->default_value("60"))
+            ("isa", "use the model evaluation kernels for this instruction set instead of the detected one "
+                    "(generic, avx2 or avx512)",
+                cxxopts::value(isa))
+            ("threads", "number of threads to evaluate the model on (default: number of hardware threads)",
+                cxxopts::value(num_threads))
+            ("resident-components", "number of components of each model of an .eosm file to read before the "
+                                    "model is displayed; the others are read in the background (-1: all)",
+                cxxopts::value(num_resident_components)->default_value("30"))
+            ("cache-dir", "directory to cache .bin and .scm models in, as native model containers, so that "
+                          "they're only parsed the first time they're loaded",
+                cxxopts::value(cache_directory))
+            ("no-cache", "don't use the model cache",
+                cxxopts::value(no_cache))
+            ("check-kernels", "validate the evaluation kernels that this CPU supports against the scalar "
+                              "reference, check that zero coefficients are skipped, and exit")
+            ("convert", "convert the given model (and blendshapes) to a native model container (.eosm), "
+                        "which loads without copying, and exit",
+                cxxopts::value(convert_file))
+            ("basis-precision", "convert the bases and blendshapes to this precision after loading (fp32, "
+                                "fp16 or int8); with --convert, the container is written in it",
+                cxxopts::value(basis_precision_name))
+            ("quantization-error", "report the per-vertex error of the model with fp16 and int8 bases, for "
+                                   "random samples (see -n, --seed and the sdevs), and exit",
+                cxxopts::value(report_quantization_error))
+            ("dense-blendshapes", "always evaluate the blendshapes as dense matrix, even if they only "
+                                  "displace a few vertices each",
+                cxxopts::value(dense_blendshapes))
+            ("headless", "don't open the viewer, but write random samples of the model as .obj files",
+                cxxopts::value(headless))
+            ("n,num-samples", "number of random samples to write in headless mode",
+                cxxopts::value(headless_options.num_samples)->default_value("100"))
+            ("o,output-dir", "existing directory to write the samples to in headless mode",
+                cxxopts::value(headless_options.output_dir)->default_value("."))
+            ("shape-sdev", "standard deviation of the shape coefficients of the random samples",
+                cxxopts::value(headless_options.sdev[0])->default_value("1.0"))
+            ("expression-sdev", "standard deviation of the expression coefficients of the random samples "
+                                "(upper bound of the interval [0, sdev] for blendshapes)",
+                cxxopts::value(headless_options.sdev[1])->default_value("1.0"))
+            ("color-sdev", "standard deviation of the colour coefficients of the random samples",
+                cxxopts::value(headless_options.sdev[2])->default_value("1.0"))
+            ("seed", "seed for the random samples in headless mode",
+                cxxopts::value(headless_options.seed)->default_value("0"))
+            ("batch-size", "number of samples to evaluate at once in headless mode (1: one sample at a time)",
+                cxxopts::value(headless_options.batch_size)->default_value("32"))
+            ("landmarks", "in headless mode, only evaluate the model's landmarks (or the --vertex vertices), "
+                          "and write their positions to landmarks.csv instead of writing .obj files",
+                cxxopts::value(headless_landmarks))
+            ("vertex", "a vertex to write with --landmarks instead of the model's landmarks (can be given "
+                       "several times)",
+                cxxopts::value(headless_vertices))
+            ("benchmark-evaluation", "measure the time the model evaluation takes when the coefficients "
+                                     "change, with -n updates per scenario, and exit",
+                cxxopts::value(benchmark_evaluation))
+            ("trace", "record the timeline of model loads and frames on all threads, and write it to this "
+                      "file on exit, as Chrome trace JSON (open it in chrome://tracing or Perfetto)",
+                cxxopts::value(trace_file));
         // clang-format on
         const auto result = options.parse(argc, argv);
         if (result.count("help"))
@@ -151,43 +333,151 @@ int main(int argc, const char* argv[])
             cout << options.help() << endl;
             return EXIT_SUCCESS;
         }
+        if (no_cache)
+        {
+            cache_directory.clear();
+        }
+        if (!basis_precision_name.empty())
+        {
+            eosviewer::BasisPrecision precision;
+            if (!eosviewer::from_string(basis_precision_name, precision))
+            {
+                cout << "Error: Unknown basis precision '" << basis_precision_name << "'." << endl;
+                return EXIT_FAILURE;
+            }
+            basis_precision = precision;
+        }
+        if (result.count("check-kernels"))
+        {
+            const bool kernels_passed = kernels::validate_kernels(cout);
+            const bool lazy_evaluation_passed = eosviewer::validate_lazy_evaluation(cout);
+            return kernels_passed && lazy_evaluation_passed ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
     } catch (const cxxopts::OptionException& e)
     {
         cout << "Error parsing options: " << e.what() << endl;
         return EXIT_FAILURE;
     }
 
-    // Note: Take the vertices here directly, so we can maybe avoid ever generating a Mesh instance
-    auto get_V = [](const core::Mesh& mesh) {
-        Eigen::MatrixXd V(mesh.vertices.size(), 3);
-        for (int i = 0; i < mesh.vertices.size(); ++i)
+    // Declared first, so the trace is written after all the threads have been stopped:
+    eosviewer::trace::Session trace_session(trace_file, cout);
+    eosviewer::trace::set_thread_name("main");
+
+    if (!isa.empty())
+    {
+        using eosviewer::kernels::Isa;
+        const auto requested_isa = isa == "avx512" ? Isa::Avx512 : (isa == "avx2" ? Isa::Avx2 : Isa::Generic);
+        if (isa != kernels::to_string(requested_isa) || !kernels::select_kernels(requested_isa))
         {
-            V(i, 0) = mesh.vertices[i](0);
-            V(i, 1) = mesh.vertices[i](1);
-            V(i, 2) = mesh.vertices[i](2);
+            cout << "Error: The evaluation kernels '" << isa << "' are unknown or not supported by this CPU."
+                 << endl;
+            return EXIT_FAILURE;
         }
-        return V;
-    };
-    auto get_F = [](const core::Mesh& mesh) {
-        Eigen::MatrixXi F(mesh.tvi.size(), 3);
-        for (int i = 0; i < mesh.tvi.size(); ++i)
+    }
+    cout << "Using the " << kernels::to_string(kernels::get_kernels().isa) << " evaluation kernels." << endl;
+
+    if (!convert_file.empty())
+    {
+        try
         {
-            F(i, 0) = mesh.tvi[i][0];
-            F(i, 1) = mesh.tvi[i][1];
-            F(i, 2) = mesh.tvi[i][2];
+            eosviewer::LoadProgress progress;
+            // The container always stores the blendshapes dense, so there's no need to make them sparse:
+            const auto model =
+                load_model(model_file, blendshapes_file, progress, -1, "", basis_precision, false);
+            cout << "Model loaded (peak RSS: " << eosviewer::get_peak_rss() / (1024 * 1024) << " MiB)."
+                 << endl;
+            const auto bytes_written = eosviewer::write_model_container(convert_file, model.view);
+            cout << "Wrote " << convert_file << " (" << bytes_written / (1024 * 1024) << " MiB)." << endl;
+        } catch (const std::runtime_error& e)
+        {
+            cout << "Error converting the model: " << e.what() << endl;
+            return EXIT_FAILURE;
         }
-        return F;
-    };
-    auto get_C = [](const core::Mesh& mesh) {
-        Eigen::MatrixXd C(mesh.colors.size(), 3);
-        for (int i = 0; i < mesh.colors.size(); ++i)
+        return EXIT_SUCCESS;
+    }
+
+    if (report_quantization_error)
+    {
+        try
+        {
+            eosviewer::LoadProgress progress;
+            const auto model =
+                load_model(model_file, blendshapes_file, progress, -1, cache_directory, {}, false);
+            eosviewer::report_quantization_error(model.view, headless_options.num_samples,
+                                                 headless_options.sdev, headless_options.seed, cout);
+        } catch (const std::runtime_error& e)
         {
-            C(i, 0) = mesh.colors[i](0);
-            C(i, 1) = mesh.colors[i](1);
-            C(i, 2) = mesh.colors[i](2);
+            cout << "Error computing the quantization error: " << e.what() << endl;
+            return EXIT_FAILURE;
         }
-        return C;
-    };
+        return EXIT_SUCCESS;
+    }
+
+    // In headless mode, we only write samples (or benchmark the evaluation), and never create a viewer
+    // (nor an OpenGL context):
+    if (headless || benchmark_evaluation)
+    {
+        if (model_file.empty())
+        {
+            cout << "Error: Headless mode requires a model (-m)." << endl;
+            return EXIT_FAILURE;
+        }
+        headless_options.num_threads = num_threads;
+        try
+        {
+            eosviewer::LoadProgress progress;
+            const auto headless_model =
+                load_model(model_file, blendshapes_file, progress, -1, cache_directory, basis_precision,
+                           !dense_blendshapes);
+            cout << "Model loaded (peak RSS: " << eosviewer::get_peak_rss() / (1024 * 1024) << " MiB)."
+                 << endl;
+            if (benchmark_evaluation)
+            {
+                eosviewer::run_evaluation_benchmark(headless_model.view, headless_options, cout);
+            } else if (headless_landmarks)
+            {
+                auto landmarks = headless_model.view.get_landmark_definitions();
+                if (!headless_vertices.empty())
+                {
+                    landmarks.clear();
+                    for (const auto vertex : headless_vertices)
+                    {
+                        landmarks.push_back({std::to_string(vertex), vertex});
+                    }
+                }
+                if (landmarks.empty())
+                {
+                    cout << "Error: The model has no landmark definitions, give the vertices with --vertex."
+                         << endl;
+                    return EXIT_FAILURE;
+                }
+                eosviewer::run_headless_landmarks(headless_model.view, landmarks, headless_options, cout);
+            } else
+            {
+                eosviewer::run_headless(headless_model.view, headless_options, cout);
+            }
+        } catch (const std::runtime_error& e)
+        {
+            cout << "Error in headless mode: " << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Models are loaded in the background, and swapped in between two frames once they're ready. A model
+    // given on the command line starts loading right away, while the viewer and OpenGL are initialised:
+    eosviewer::AsyncModelLoader model_loader;
+    auto load_start_time = std::chrono::steady_clock::now();
+    if (!model_file.empty())
+    {
+        cout << "Loading Morphable Model " << model_file << "..." << endl;
+        // Loads a .bin, .scm or .eosm model, with or without blendshapes:
+        model_loader.start([model_file, blendshapes_file, num_resident_components, cache_directory,
+                            basis_precision, dense_blendshapes](eosviewer::LoadProgress& progress) {
+            return load_model(model_file, blendshapes_file, progress, num_resident_components,
+                              cache_directory, basis_precision, !dense_blendshapes);
+        });
+    }
 
     // Init the viewer:
     igl::opengl::glfw::Viewer viewer;
@@ -196,28 +486,38 @@ int main(int argc, const char* argv[])
     igl::opengl::glfw::imgui::ImGuiMenu menu;
     viewer.plugins.push_back(&menu);
 
-    morphablemodel::MorphableModel morphable_model;
-    // Load the model right away on start up, if it was given via command-line parameters:
-    if (!model_file.empty())
-    {
-        try
+    // The current model. It's accessed through its view, which always refers to the current model:
+    eosviewer::LoadedModel loaded_model;
+    const eosviewer::ModelView& morphable_model = loaded_model.view;
+
+    // Buffers in the N x 3 layout of the viewer, used to set up a new mesh. The vertices and colours of
+    // each update are written directly into the viewer's own buffers:
+    Eigen::MatrixXd vertex_buffer;
+    Eigen::MatrixXd color_buffer;
+    std::size_t bytes_copied_last_update = 0;
+
+    // Sets up the viewer with the mean of the current model. We take the vertices and colours directly
+    // from the PCA models, and avoid ever generating a core::Mesh instance.
+    auto set_mesh_to_model_mean = [&]() {
+        const auto& shape_model = morphable_model.get_shape_model();
+        eosviewer::copy_to_viewer_layout(shape_model.get_mean(), vertex_buffer);
+        viewer.data().clear();
+        {
+            eosviewer::trace::Span span("set_mesh");
+            viewer.data().set_mesh(vertex_buffer,
+                                   eosviewer::to_viewer_faces(morphable_model.get_triangles()));
+        }
         {
-            // Loads a .bin or .scm model, with or without blendshapes:
-            morphable_model = load_model(model_file, blendshapes_file);
-            const auto& mean = morphable_model.get_mean();
-            viewer.data().set_mesh(get_V(mean), get_F(mean));
+            eosviewer::trace::Span span("align_camera_center");
             viewer.core.align_camera_center(viewer.data().V, viewer.data().F);
-            if (!mean.colors.empty())
-            {
-                viewer.data().set_colors(get_C(mean));
-            }
-
-        } catch (const std::runtime_error& e)
+        }
+        const auto color_mean = morphable_model.get_color_model().get_mean();
+        if (color_mean.size() > 0)
         {
-            cout << "Error loading the given model: " << e.what() << endl;
-            return EXIT_FAILURE;
+            eosviewer::copy_to_viewer_layout(color_mean, color_buffer);
+            viewer.data().set_colors(color_buffer);
         }
-    }
+    };
 
     // These are the coefficients of the currently active mesh instance:
     vector<float> shape_coefficients;
@@ -228,8 +528,117 @@ int main(int argc, const char* argv[])
     std::default_random_engine rng;
     std::array<float, 3> random_sample_sdev = {1.0f, 1.0f, 1.0f}; // shp, exp, col
 
+    // The time each stage of a frame takes is recorded for the last frames, and shown with --profile. It's
+    // declared before the evaluator, as the evaluator's thread records its evaluations in it:
+    eosviewer::StageProfiler profiler;
+    const int frame_stage = profiler.add_stage("frame");
+    const int model_swap_stage = profiler.add_stage("model swap");
+    const int mesh_draw_stage = profiler.add_stage("mesh upload & draw");
+    const int ui_layout_stage = profiler.add_stage("UI layout");
+    const int copy_to_viewer_stage = profiler.add_stage("copy to viewer");
+    const int landmarks_stage = profiler.add_stage("landmarks");
+    const int evaluation_stage = profiler.add_stage("evaluation (worker)");
+    eosviewer::StageProfiler::clock::time_point frame_start, mesh_draw_start, ui_layout_start;
+    std::vector<float> profile_history;
+
+    // Keeps the current instance, and only re-evaluates the parts whose coefficients have changed. The
+    // evaluation runs on its own thread, so that the UI doesn't wait for it, and large models are evaluated
+    // in tiles of vertices on a pool of threads. As the viewer only redraws on events, a finished
+    // evaluation posts an empty event, so that the next frame shows it:
+    eosviewer::ThreadPool thread_pool(num_threads);
+    eosviewer::AsyncModelEvaluator evaluator([]() { glfwPostEmptyEvent(); });
+    evaluator.set_thread_pool(&thread_pool);
+    evaluator.set_profiler(&profiler, evaluation_stage);
+    evaluator.set_model(loaded_model);
+
+    // The landmarks of the current model are shown as points. They are evaluated with a model of only their
+    // vertices (which is made when they are first shown), from the same coefficients as the mesh, and with
+    // its own evaluator, which is marked dirty together with the mesh's. That one is so fast that it runs on
+    // the UI thread:
+    vector<eosviewer::LandmarkDefinition> landmarks;
+    eosviewer::LoadedModel landmark_model;
+    eosviewer::ModelEvaluator landmark_evaluator;
+    bool show_landmarks = false;
+    Eigen::MatrixXd landmark_buffer;
+
+    // Slider labels and other text of the current frame are formatted into this arena, so that a frame in
+    // which no model is loaded does not need any heap allocations:
+    eosviewer::FrameArena frame_arena;
+    eosviewer::CoefficientPanel shape_panel, color_panel, expression_panel;
+
+    // The viewer only redraws on input events, so an idle viewer doesn't use the CPU. While a model is
+    // loading, it redraws continuously, so that the progress is shown, and the model is swapped in as
+    // soon as it's ready. Both are capped at max_fps:
+    eosviewer::FramePacer frame_pacer(max_fps);
+    viewer.core.animation_max_fps = max_fps > 0.0 ? max_fps : std::numeric_limits<double>::max();
+    viewer.core.is_animating = model_loader.is_loading();
+    const auto start_loading = [&](eosviewer::AsyncModelLoader::LoadFunction load) {
+        if (!model_loader.start(std::move(load)))
+        {
+            cout << "Another model is still being loaded, please try again once it's done." << endl;
+            return;
+        }
+        load_start_time = std::chrono::steady_clock::now();
+        viewer.core.is_animating = true;
+    };
+    // Swaps in a model that has finished loading. The previous model is rendered until then.
+    const auto swap_in_loaded_model = [&]() {
+        eosviewer::LoadedModel new_model;
+        string error;
+        if (!model_loader.poll(new_model, error))
+        {
+            return;
+        }
+        viewer.core.is_animating = false;
+        if (!error.empty())
+        {
+            cout << "Error loading the model: " << error << endl;
+            return;
+        }
+        loaded_model = std::move(new_model);
+        set_mesh_to_model_mean();
+        evaluator.set_model(loaded_model);
+        landmarks = morphable_model.get_landmark_definitions();
+        landmark_model = eosviewer::LoadedModel();
+        landmark_evaluator.set_model(landmark_model.view);
+        if (morphable_model.has_separate_expression_model())
+        {
+            // Just a sensible default - if the loaded model has expressions, use them by default:
+            display_identity_model_only = false;
+        }
+        const std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start_time;
+        cout << "Model loaded in " << load_time.count()
+             << " s (peak RSS: " << eosviewer::get_peak_rss() / (1024 * 1024) << " MiB)." << endl;
+    };
+
+    // Count the heap allocations of each frame, from the start to the end of the viewer's draw():
+    eosviewer::AllocationStats frame_start_allocations;
+    eosviewer::AllocationStats last_frame_allocations;
+    viewer.callback_pre_draw = [&](igl::opengl::glfw::Viewer&) {
+        frame_start_allocations = eosviewer::get_allocation_stats();
+        frame_start = eosviewer::StageProfiler::clock::now();
+        {
+            eosviewer::ScopedStageTimer timer(profiler, model_swap_stage);
+            swap_in_loaded_model();
+        }
+        // The viewer uploads and draws the meshes after this, and then the menu, which calls our window
+        // callback:
+        mesh_draw_start = eosviewer::StageProfiler::clock::now();
+        return false;
+    };
+    viewer.callback_post_draw = [&](igl::opengl::glfw::Viewer&) {
+        last_frame_allocations = eosviewer::get_allocation_stats() - frame_start_allocations;
+        profiler.record(frame_stage, frame_start, eosviewer::StageProfiler::clock::now());
+        frame_pacer.end_frame();
+        return false;
+    };
+
     // Draw our viewers windows:
     menu.callback_draw_custom_window = [&]() {
+        ui_layout_start = eosviewer::StageProfiler::clock::now();
+        profiler.record(mesh_draw_stage, mesh_draw_start, ui_layout_start);
+        frame_arena.reset();
+
         // Load model & draw sample options:
         ImGui::SetNextWindowPos(ImVec2(0.f * menu.menu_scaling(), 585), ImGuiSetCond_FirstUseEver);
         ImGui::SetNextWindowSize(ImVec2(240, 280), ImGuiSetCond_FirstUseEver);
@@ -238,165 +647,69 @@ int main(int argc, const char* argv[])
         {
             const string mm_fn = igl::file_dialog_open();
             cout << "Loading Morphable Model " << mm_fn << "..." << endl;
-            try
-            {
-                morphable_model = load_bin_or_scm_model(mm_fn);
-                const auto& mean = morphable_model.get_mean();
-                viewer.data().clear();
-                viewer.data().set_mesh(get_V(mean), get_F(mean));
-                viewer.core.align_camera_center(viewer.data().V, viewer.data().F);
-                if (!mean.colors.empty())
-                {
-                    viewer.data().set_colors(get_C(mean));
-                }
-            } catch (const std::runtime_error&
-                         e) // Todo: I think we have to catch more errors here, like cereal exceptions
-            {
-                cout << "Error loading the given model: " << e.what() << endl;
-            }
-            if (morphable_model.has_separate_expression_model())
-            {
-                // Just a sensible default - if the loaded model has expressions, use them by default:
-                display_identity_model_only = false;
-            }
+            start_loading([mm_fn, num_resident_components, cache_directory, basis_precision,
+                           dense_blendshapes](eosviewer::LoadProgress& progress) {
+                return load_model(mm_fn, "", progress, num_resident_components, cache_directory,
+                                  basis_precision, !dense_blendshapes);
+            });
         }
         if (ImGui::Button("Load Blendshapes", ImVec2(-1, 0)))
         {
             const string bs_fn = igl::file_dialog_open();
             cout << "Loading Blendshapes " << bs_fn << "..." << endl;
-            morphablemodel::Blendshapes blendshapes;
-            try
-            {
-                blendshapes = morphablemodel::load_blendshapes(bs_fn);
-                cout << "Blendshapes loaded. Constructing a new model consisting of the loaded identity and "
-                        "colour PCA models, and the loaded blendshapes..."
-                     << endl;
-                morphable_model = morphablemodel::MorphableModel(
-                    morphable_model.get_shape_model(), blendshapes, morphable_model.get_color_model(),
-                    morphable_model.get_landmark_definitions(), morphable_model.get_texture_coordinates());
-                const auto& mean = morphable_model.get_mean();
-                viewer.data().clear();
-                viewer.data().set_mesh(get_V(mean), get_F(mean));
-                viewer.core.align_camera_center(viewer.data().V, viewer.data().F);
-                if (!mean.colors.empty())
+            // The new model consists of the current identity and colour PCA models, which are shared and
+            // not copied, and the loaded blendshapes. Those are converted to the precision of the bases,
+            // like the ones loaded together with a model:
+            const auto current_model = loaded_model;
+            start_loading([bs_fn, current_model, basis_precision,
+                           dense_blendshapes](eosviewer::LoadProgress& progress) {
+                auto model = eosviewer::with_blendshapes(current_model, load_blendshapes(bs_fn, progress));
+                if (basis_precision)
                 {
-                    viewer.data().set_colors(get_C(mean));
+                    model = eosviewer::with_quantized_blendshapes(model, *basis_precision);
                 }
-
-            } catch (const std::runtime_error&
-                         e) // Todo: I think we have to catch more errors here, like cereal exceptions
-            {
-                cout << "Error loading the given blendshapes: " << e.what() << endl;
-            }
-            display_identity_model_only = false;
+                return dense_blendshapes ? model : use_sparse_blendshapes(model);
+            });
+        }
+        if (model_loader.is_loading())
+        {
+            const auto& progress = model_loader.get_progress();
+            const double mebibytes_read = progress.bytes_read / (1024.0 * 1024.0);
+            const double mebibytes_total = progress.bytes_total / (1024.0 * 1024.0);
+            const float fraction_read =
+                mebibytes_total > 0.0 ? static_cast<float>(mebibytes_read / mebibytes_total) : 0.0f;
+            ImGui::ProgressBar(fraction_read, ImVec2(-1, 0),
+                               frame_arena.format("%.0f/%.0f MiB", mebibytes_read, mebibytes_total));
+            ImGui::Text("Sections decoded: %d/%d", progress.sections_decoded.load(),
+                        progress.sections_total.load());
         }
         ImGui::Separator();
         if (ImGui::Button("Mean (id)", ImVec2(-1, 0)))
         {
-            Eigen::VectorXf mean = morphable_model.get_shape_model().get_mean();
-            // Take 3 at a piece, then transpose:
-            const auto num_vertices = mean.rows() / 3;
-            Eigen::Map<Eigen::MatrixXf> mean_reshaped(mean.data(), 3, num_vertices);
-            viewer.data().set_vertices(mean_reshaped.transpose().cast<double>());
-
-            if (morphable_model.get_color_model().get_mean().size() > 0)
-            {
-                Eigen::VectorXf color_mean = morphable_model.get_color_model().get_mean();
-                Eigen::Map<Eigen::MatrixXf> color_mean_reshaped(
-                    color_mean.data(), 3,
-                    color_mean.rows() / 3); // Todo: This will fail for gray-level models
-                viewer.data().set_colors(color_mean_reshaped.transpose().cast<double>());
-            }
-
+            // The mean is the instance with all coefficients set to zero:
             for_each(begin(shape_coefficients), end(shape_coefficients), [](auto& coeff) { coeff = 0.0f; });
             for_each(begin(color_coefficients), end(color_coefficients), [](auto& coeff) { coeff = 0.0f; });
             for_each(begin(expression_coefficients), end(expression_coefficients),
                      [](auto& coeff) { coeff = 0.0f; });
             display_identity_model_only = true;
+            evaluator.mark_all_dirty();
         }
         if (ImGui::Button("Mean (id+exp)", ImVec2(-1, 0)))
         {
-            const auto mean = morphable_model.get_mean();
-            viewer.data().set_vertices(get_V(mean));
-            if (!mean.colors.empty())
-            {
-                viewer.data().set_colors(get_C(mean));
-            }
             for_each(begin(shape_coefficients), end(shape_coefficients), [](auto& coeff) { coeff = 0.0f; });
             for_each(begin(color_coefficients), end(color_coefficients), [](auto& coeff) { coeff = 0.0f; });
             for_each(begin(expression_coefficients), end(expression_coefficients),
                      [](auto& coeff) { coeff = 0.0f; });
             display_identity_model_only = false;
+            evaluator.mark_all_dirty();
         }
         ImGui::Separator();
         if (ImGui::Button("Random face sample", ImVec2(-1, 0)))
         {
-            // Shape sample:
-            std::normal_distribution<float> shape_coeffs_dist(0.0f,
-                                                              random_sample_sdev[0]); // c'tor takes stddev
-            shape_coefficients =
-                vector<float>(morphable_model.get_shape_model().get_num_principal_components());
-            for_each(begin(shape_coefficients), end(shape_coefficients),
-                     [&rng, &shape_coeffs_dist](auto& coeff) { coeff = shape_coeffs_dist(rng); });
-            // Expression sample:
-            if (morphable_model.has_separate_expression_model())
-            {
-
-                if (eos::cpp17::holds_alternative<morphablemodel::Blendshapes>(
-                        morphable_model.get_expression_model().value()))
-                {
-                    std::uniform_real_distribution<float> expression_coeffs_dist(
-                        0.0f,
-                        random_sample_sdev[1]); // using the interval [0, sdev] (so it's not really an sdev
-                                                // here!)
-                    const auto expression_model_num_coeffs =
-                        eos::cpp17::get<morphablemodel::Blendshapes>(
-                            morphable_model.get_expression_model().value())
-                            .size();
-                    expression_coefficients = vector<float>(expression_model_num_coeffs);
-                    for_each(begin(expression_coefficients), end(expression_coefficients),
-                             [&rng, &expression_coeffs_dist](auto& coeff) {
-                                 coeff = expression_coeffs_dist(rng);
-                             });
-
-                } else if (eos::cpp17::holds_alternative<morphablemodel::PcaModel>(
-                               morphable_model.get_expression_model().value()))
-                {
-                    std::normal_distribution<float> expression_coeffs_dist(0.0f, random_sample_sdev[1]);
-                    const auto expression_model_num_coeffs =
-                        eos::cpp17::get<morphablemodel::PcaModel>(
-                            morphable_model.get_expression_model().value())
-                            .get_num_principal_components();
-                    expression_coefficients = vector<float>(expression_model_num_coeffs);
-                    for_each(begin(expression_coefficients), end(expression_coefficients),
-                             [&rng, &expression_coeffs_dist](auto& coeff) {
-                                 coeff = expression_coeffs_dist(rng);
-                             });
-                }
-            }
-            // Colour sample:
-            std::normal_distribution<float> color_coeffs_dist(0.0f, random_sample_sdev[2]);
-            color_coefficients =
-                vector<float>(morphable_model.get_color_model().get_num_principal_components());
-            for_each(begin(color_coefficients), end(color_coefficients),
-                     [&rng, &color_coeffs_dist](auto& coeff) { coeff = color_coeffs_dist(rng); });
-
-            // Now generate the sample:
-            core::Mesh sample;
-            // Note: Can it happen that we pass in colour-coeffs, but it's a model without colour?
-            if (morphable_model.has_separate_expression_model())
-            {
-                sample = morphable_model.draw_sample(shape_coefficients, expression_coefficients,
-                                                     color_coefficients);
-            } else
-            {
-                sample = morphable_model.draw_sample(shape_coefficients, color_coefficients);
-            }
-            viewer.data().set_vertices(get_V(sample));
-            if (!sample.colors.empty())
-            {
-                viewer.data().set_colors(get_C(sample));
-            }
+            eosviewer::draw_random_coefficients(morphable_model, random_sample_sdev, rng, shape_coefficients,
+                                                expression_coefficients, color_coefficients);
+            // The sample is generated by the evaluator, at the end of this frame:
+            evaluator.mark_all_dirty();
         }
         /* // Not yet implemented:
         if (ImGui::Button("Random identity sample", ImVec2(-1, 0)))
@@ -410,174 +723,200 @@ int main(int argc, const char* argv[])
         }
         */
         ImGui::InputFloat3("sdev [shp, exp, col]", &random_sample_sdev[0], 2);
-        ImGui::Checkbox("Identity model only", &display_identity_model_only);
+        if (ImGui::Checkbox("Identity model only", &display_identity_model_only))
+        {
+            evaluator.mark_dirty(ModelPart::Expression);
+        }
+        if (landmarks.empty())
+        {
+            ImGui::TextDisabled("The model has no landmarks.");
+        } else if (ImGui::Checkbox("Show landmarks", &show_landmarks) && !show_landmarks)
+        {
+            viewer.data().set_points(Eigen::MatrixXd(0, 3), Eigen::MatrixXd(0, 3));
+        }
+        ImGui::Text("Bytes copied per update: %llu",
+                    static_cast<unsigned long long>(bytes_copied_last_update));
+        ImGui::Text("Redraws: %d/s (%s)", frame_pacer.get_redraw_rate(),
+                    viewer.core.is_animating ? "continuous" : "on input");
+        ImGui::Text("Evaluation: %s", evaluator.is_busy() ? "running" : "idle");
         ImGui::End(); // end "Morphable Model" window
 
-        // PCA shape coefficients:
+        // PCA shape coefficients. All coefficients have a slider, but only the visible ones are drawn:
         ImGui::SetNextWindowPos(ImVec2(180.f * menu.menu_scaling(), 0), ImGuiSetCond_FirstUseEver);
         ImGui::SetNextWindowSize(ImVec2(200, 160), ImGuiSetCond_FirstUseEver);
         ImGui::Begin("Shape PCA", nullptr, ImGuiWindowFlags_NoSavedSettings);
-
-        ImGui::Text("Coefficients");
-        if (morphable_model.get_shape_model().get_num_principal_components() > 0) // a model was loaded
+        const auto num_shape_coefficients =
+            static_cast<std::size_t>(morphable_model.get_shape_model().get_num_principal_components());
+        if (shape_coefficients.size() != num_shape_coefficients)
         {
-            int num_shape_coeffs_to_display =
-                std::min(morphable_model.get_shape_model().get_num_principal_components(), 30);
-
-            if (shape_coefficients.empty() || shape_coefficients.size() != num_shape_coeffs_to_display)
-            {
-                // no coeffs yet, or number of coeffs has changed for some reason:
-                shape_coefficients.resize(num_shape_coeffs_to_display);
-            }
-            // shape_coefficients are always initialised now.
-
-            ImGui::BeginGroup();
-            for (int i = 0; i < num_shape_coeffs_to_display; ++i)
-            {
-                const string label = std::to_string(i);
-                ImGui::SliderFloat(label.c_str(), &shape_coefficients[i], -3.0, 3.0);
-            }
-            ImGui::EndGroup();
-            string coeffs_displayed =
-                "Displaying " + std::to_string(num_shape_coeffs_to_display) + "/" +
-                std::to_string(morphable_model.get_shape_model().get_num_principal_components()) +
-                " coefficients.";
-            ImGui::Text(coeffs_displayed.c_str());
-
-            // We've got a shape model. So update the mesh that's been drawn with the value of the
-            // coefficients. Note that we are currently doing this every draw call, not only when the
-            // slider changes. See eos-model-viewer/issues/5.
-            VectorXf shape_instance = morphable_model.get_shape_model().draw_sample(shape_coefficients);
-            const auto num_vertices = morphable_model.get_shape_model().get_data_dimension() / 3;
-            // If expression coeffs are set, add the expression part:
-            if (!expression_coefficients.empty() && morphable_model.has_separate_expression_model() &&
-                !display_identity_model_only)
-            {
-                if (eos::cpp17::holds_alternative<morphablemodel::PcaModel>(
-                        morphable_model.get_expression_model().value()))
-                {
-                    const auto& expression_model = eos::cpp17::get<morphablemodel::PcaModel>(
-                        morphable_model.get_expression_model().value());
-                    const VectorXf expression_instance =
-                        expression_model.draw_sample(expression_coefficients);
-                    shape_instance += expression_instance;
-                } else if (eos::cpp17::holds_alternative<morphablemodel::Blendshapes>(
-                               morphable_model.get_expression_model().value()))
-                {
-                    const auto& blendshapes = eos::cpp17::get<morphablemodel::Blendshapes>(
-                        morphable_model.get_expression_model().value());
-                    for (int i = 0; i < blendshapes.size(); ++i)
-                    {
-                        shape_instance += blendshapes[i].deformation * expression_coefficients[i];
-                    }
-                }
-            }
-            Eigen::Map<Eigen::MatrixXf> shape_instance_reshaped(
-                shape_instance.data(), 3, num_vertices); // Take 3 at a piece, then transpose below
-            viewer.data().set_vertices(shape_instance_reshaped.transpose().cast<double>());
+            // No coefficients yet, or a model with a different number of them has been loaded:
+            shape_coefficients.resize(num_shape_coefficients);
+            evaluator.mark_dirty(ModelPart::Shape);
+        }
+        if (shape_panel.draw(shape_coefficients, -3.0f, 3.0f, frame_arena))
+        {
+            evaluator.mark_dirty(ModelPart::Shape);
         }
-
         ImGui::End(); // end "Shape PCA" window
 
         // PCA colour coefficients:
         ImGui::SetNextWindowPos(ImVec2(380.f * menu.menu_scaling(), 0), ImGuiSetCond_FirstUseEver);
         ImGui::SetNextWindowSize(ImVec2(200, 160), ImGuiSetCond_FirstUseEver);
         ImGui::Begin("Colour PCA", nullptr, ImGuiWindowFlags_NoSavedSettings);
-
-        ImGui::Text("Coefficients");
-        if (morphable_model.get_color_model().get_num_principal_components() > 0) // a model was loaded
+        const auto num_color_coefficients =
+            static_cast<std::size_t>(morphable_model.get_color_model().get_num_principal_components());
+        if (color_coefficients.size() != num_color_coefficients)
         {
-            int num_color_coeffs_to_display =
-                std::min(morphable_model.get_color_model().get_num_principal_components(), 30);
-
-            if (color_coefficients.empty() || color_coefficients.size() != num_color_coeffs_to_display)
-            {
-                color_coefficients.resize(num_color_coeffs_to_display);
-            }
-            // color_coefficients are always initialised now.
-
-            ImGui::BeginGroup();
-            for (int i = 0; i < num_color_coeffs_to_display; ++i)
-            {
-                const string label = std::to_string(i);
-                ImGui::SliderFloat(label.c_str(), &color_coefficients[i], -3.0, 3.0);
-            }
-            ImGui::EndGroup();
-            string coeffs_displayed =
-                "Displaying " + std::to_string(num_color_coeffs_to_display) + "/" +
-                std::to_string(morphable_model.get_color_model().get_num_principal_components()) +
-                " coefficients.";
-            ImGui::Text(coeffs_displayed.c_str());
-
-            // We've got a colour model. So update the mesh that's been drawn with the value of the
-            // coefficients. Note that we are currently doing this every draw call, not only when the
-            // slider changes. See eos-model-viewer/issues/5.
-            VectorXf color_instance = morphable_model.get_color_model().draw_sample(color_coefficients);
-            const auto num_vertices = morphable_model.get_color_model().get_data_dimension() /
-                                      3; // will break for gray-level models!
-            Eigen::Map<Eigen::MatrixXf> color_instance_reshaped(
-                color_instance.data(), 3, num_vertices); // Take 3 at a piece, then transpose below
-            viewer.data().set_colors(color_instance_reshaped.transpose().cast<double>());
+            color_coefficients.resize(num_color_coefficients);
+            evaluator.mark_dirty(ModelPart::Color);
+        }
+        if (color_panel.draw(color_coefficients, -3.0f, 3.0f, frame_arena))
+        {
+            evaluator.mark_dirty(ModelPart::Color);
         }
-
         ImGui::End(); // end "Colour PCA" window
 
-        // PCA expression coefficients:
+        // PCA expression coefficients, or blendshape coefficients:
         ImGui::SetNextWindowPos(ImVec2(580.f * menu.menu_scaling(), 0), ImGuiSetCond_FirstUseEver);
         ImGui::SetNextWindowSize(ImVec2(200, 160), ImGuiSetCond_FirstUseEver);
         ImGui::Begin("Expression PCA", nullptr, ImGuiWindowFlags_NoSavedSettings);
+        const auto num_expression_coefficients =
+            static_cast<std::size_t>(morphable_model.get_num_expression_coefficients());
+        if (expression_coefficients.size() != num_expression_coefficients)
+        {
+            expression_coefficients.resize(num_expression_coefficients);
+            evaluator.mark_dirty(ModelPart::Expression);
+        }
+        const bool has_blendshapes =
+            morphable_model.expression_model_type == eosviewer::ExpressionModelType::Blendshapes;
+        const float expression_slider_min = has_blendshapes ? -1.0f : -3.0f;
+        if (expression_panel.draw(expression_coefficients, expression_slider_min, 3.0f, frame_arena))
+        {
+            evaluator.mark_dirty(ModelPart::Expression);
+        }
+        ImGui::End(); // end "Expression PCA" window
 
-        ImGui::Text("Coefficients");
-        if (morphable_model.has_separate_expression_model()) // a model was loaded
+        // Now that all the coefficients of this frame are known, request the re-evaluation of the parts of
+        // the instance that have changed, and upload the ones of the latest finished evaluation to the
+        // viewer. In frames where nothing changed, this does nothing (previously, we evaluated the whole
+        // model every frame, see eos-model-viewer/issues/5). While an evaluation runs, the UI keeps running,
+        // and the requests of the frames in between are replaced by the latest.
+        for (const auto part : {ModelPart::Shape, ModelPart::Expression})
         {
-            int expression_model_num_coeffs = 0;
-            float slider_min_range = -3.0f;
-            float slider_max_range = +3.0f;
-            if (eos::cpp17::holds_alternative<morphablemodel::Blendshapes>(
-                    morphable_model.get_expression_model().value()))
+            if (evaluator.is_dirty(part))
             {
-                expression_model_num_coeffs = eos::cpp17::get<morphablemodel::Blendshapes>(
-                                                  morphable_model.get_expression_model().value())
-                                                  .size();
-                slider_min_range = -1.0f;
-            } else if (eos::cpp17::holds_alternative<morphablemodel::PcaModel>(
-                           morphable_model.get_expression_model().value()))
+                landmark_evaluator.mark_dirty(part);
+            }
+        }
+        evaluator.request_update(shape_coefficients, expression_coefficients, color_coefficients,
+                                 !display_identity_model_only);
+        profiler.record(ui_layout_stage, ui_layout_start, eosviewer::StageProfiler::clock::now());
+        std::size_t bytes_copied = 0;
+        const auto copy_to_viewer = [&](const VectorXf& shape_instance, const VectorXf& color_instance,
+                                        const eosviewer::UpdateResult& update) {
+            if (update.vertices_changed)
             {
-                expression_model_num_coeffs =
-                    eos::cpp17::get<morphablemodel::PcaModel>(morphable_model.get_expression_model().value())
-                        .get_num_principal_components();
+                // Written in place into the viewer's vertex buffer, which is then marked for re-upload:
+                bytes_copied += eosviewer::copy_to_viewer_layout(shape_instance, viewer.data().V);
+                viewer.data().dirty |= igl::opengl::MeshGL::DIRTY_POSITION;
             }
-
-            int num_expression_coeffs_to_display = std::min(expression_model_num_coeffs, 30);
-
-            if (expression_coefficients.empty() ||
-                expression_coefficients.size() != num_expression_coeffs_to_display)
+            if (update.colors_changed)
+            {
+                // Will break for gray-level models! The colours are written in place into the viewer's
+                // material buffers. Only if these haven't been set up for per-vertex colours yet, we go via
+                // set_colors().
+                auto& data = viewer.data();
+                const auto bytes_written =
+                    eosviewer::write_viewer_colors(color_instance, data.V_material_diffuse,
+                                                   data.V_material_ambient, data.V_material_specular);
+                if (bytes_written > 0)
+                {
+                    data.dirty |= igl::opengl::MeshGL::DIRTY_DIFFUSE | igl::opengl::MeshGL::DIRTY_AMBIENT |
+                                  igl::opengl::MeshGL::DIRTY_SPECULAR;
+                    bytes_copied += bytes_written;
+                } else
+                {
+                    bytes_copied += eosviewer::copy_to_viewer_layout(color_instance, color_buffer);
+                    data.set_colors(color_buffer);
+                }
+            }
+        };
+        {
+            eosviewer::ScopedStageTimer timer(profiler, copy_to_viewer_stage);
+            if (evaluator.take_latest(copy_to_viewer))
             {
-                expression_coefficients.resize(num_expression_coeffs_to_display);
+                bytes_copied_last_update = bytes_copied;
             }
-            // expression_coefficients are always initialised now.
-
-            ImGui::BeginGroup();
-            for (int i = 0; i < num_expression_coeffs_to_display; ++i)
+        }
+        if (show_landmarks && !landmarks.empty())
+        {
+            eosviewer::ScopedStageTimer timer(profiler, landmarks_stage);
+            if (landmark_model.empty())
             {
-                const string label = std::to_string(i);
-                ImGui::SliderFloat(label.c_str(), &expression_coefficients[i], slider_min_range,
-                                   slider_max_range);
+                const auto landmark_vertices = eosviewer::get_vertex_indices(landmarks);
+                landmark_model = eosviewer::make_vertex_subset_model(morphable_model, landmark_vertices);
+                landmark_evaluator.set_model(landmark_model.view);
             }
-            ImGui::EndGroup();
-            string coeffs_displayed = "Displaying " + std::to_string(num_expression_coeffs_to_display) + "/" +
-                                      std::to_string(expression_model_num_coeffs) + " coefficients.";
-            ImGui::Text(coeffs_displayed.c_str());
+            const auto landmark_update =
+                landmark_evaluator.update(shape_coefficients, expression_coefficients, color_coefficients,
+                                          !display_identity_model_only);
+            if (landmark_update.vertices_changed)
+            {
+                eosviewer::copy_to_viewer_layout(landmark_evaluator.get_shape_instance(), landmark_buffer);
+                viewer.data().set_points(landmark_buffer, Eigen::RowVector3d(1.0, 0.0, 0.0));
+            }
+        }
 
-            // We're not updating the mesh here. The identity-update above already updates it, since we update
-            // in each frame, and not just when a slider has moved. As long as we always have an identity
-            // model, this is fine.
+        if (show_allocation_stats)
+        {
+            ImGui::SetNextWindowPos(ImVec2(0.f * menu.menu_scaling(), 870), ImGuiSetCond_FirstUseEver);
+            ImGui::Begin("Allocations", nullptr,
+                         ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_AlwaysAutoResize);
+            ImGui::Text("Last frame: %llu allocations, %llu bytes",
+                        static_cast<unsigned long long>(last_frame_allocations.num_allocations),
+                        static_cast<unsigned long long>(last_frame_allocations.num_bytes));
+            ImGui::End();
         }
 
-        ImGui::End(); // end "Expression PCA" window
+        if (show_profiler)
+        {
+            ImGui::SetNextWindowPos(ImVec2(240.f * menu.menu_scaling(), 870), ImGuiSetCond_FirstUseEver);
+            ImGui::Begin("Profiler", nullptr,
+                         ImGuiWindowFlags_NoSavedSettings | ImGuiWindowFlags_AlwaysAutoResize);
+            for (int stage = 0; stage < profiler.get_num_stages(); ++stage)
+            {
+                const auto statistics = profiler.get_statistics(stage);
+                ImGui::Text("%s: min %.2f, avg %.2f, p99 %.2f, max %.2f ms",
+                            profiler.get_stage_name(stage).c_str(), statistics.min, statistics.average,
+                            statistics.p99, statistics.max);
+                profiler.get_history(stage, profile_history);
+                ImGui::PushID(stage);
+                ImGui::PlotHistogram("##times", profile_history.data(),
+                                     static_cast<int>(profile_history.size()), 0, nullptr, 0.0f,
+                                     std::numeric_limits<float>::max(), ImVec2(0, 40));
+                ImGui::PopID();
+            }
+            if (ImGui::Button("Write profile.csv", ImVec2(-1, 0)))
+            {
+                try
+                {
+                    profiler.write_csv("profile.csv");
+                    cout << "Wrote the recorded stage times to profile.csv." << endl;
+                } catch (const std::exception& e)
+                {
+                    cout << "Error writing the stage times: " << e.what() << endl;
+                }
+            }
+            ImGui::End();
+        }
     };
 
-    viewer.launch();
+    // Like viewer.launch(), but the evaluator is stopped before GLFW is terminated, since it wakes up
+    // GLFW whenever a result is ready:
+    viewer.launch_init();
+    viewer.launch_rendering();
+    evaluator.stop();
+    viewer.launch_shut();
 
     return EXIT_SUCCESS;
 }
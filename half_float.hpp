@@ -0,0 +1,113 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: half_float.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_HALF_FLOAT_HPP
+#define EOSVIEWER_HALF_FLOAT_HPP
+
+#include <cstdint>
+#include <cstring>
+
+namespace eosviewer {
+
+/**
+ * Converts a float to an IEEE 754 half-precision float (fp16), given by its bits, with rounding to
+ * nearest even. Values that are too large for fp16 are clamped to the largest finite fp16 value
+ * (65504) instead of becoming infinity, so a basis never contains infinities.
+ */
+inline std::uint16_t float_to_half(float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const auto sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000u);
+    bits &= 0x7fffffffu;
+    if (bits > 0x7f800000u) // NaN
+    {
+        return sign | 0x7e00u;
+    }
+    if (bits >= 0x477ff000u) // rounds to 65520 or more, or infinity
+    {
+        return sign | 0x7bffu;
+    }
+    if (bits < 0x38800000u) // smaller than the smallest normal fp16 value (2^-14)
+    {
+        if (bits < 0x33000000u) // 2^-25 or less, which rounds to zero
+        {
+            return sign;
+        }
+        const auto exponent = bits >> 23;
+        const auto mantissa = (bits & 0x7fffffu) | 0x800000u;
+        const auto shift = 126 - exponent;
+        auto half = mantissa >> shift;
+        const auto remainder = mantissa & ((1u << shift) - 1);
+        const auto halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1u)))
+        {
+            ++half;
+        }
+        return sign | static_cast<std::uint16_t>(half);
+    }
+    // Re-bias the exponent from 127 to 15, and round the mantissa from 23 to 10 bits (a carry into the
+    // exponent is correct):
+    auto half = (bits >> 13) - ((127u - 15u) << 10);
+    const auto remainder = bits & 0x1fffu;
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u)))
+    {
+        ++half;
+    }
+    return sign | static_cast<std::uint16_t>(half);
+};
+
+/**
+ * Converts an IEEE 754 half-precision float (fp16), given by its bits, to a float. This is exact.
+ */
+inline float half_to_float(std::uint16_t half)
+{
+    const std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000u) << 16;
+    std::uint32_t exponent = (half >> 10) & 0x1fu;
+    std::uint32_t mantissa = half & 0x3ffu;
+    std::uint32_t bits;
+    if (exponent == 0x1f) // infinity or NaN
+    {
+        bits = sign | 0x7f800000u | (mantissa << 13);
+    } else if (exponent != 0)
+    {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    } else if (mantissa == 0)
+    {
+        bits = sign;
+    } else // a subnormal fp16 value, which is a normal float
+    {
+        exponent = 127 - 15 + 1;
+        while ((mantissa & 0x400u) == 0)
+        {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ffu) << 13);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_HALF_FLOAT_HPP */
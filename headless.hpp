@@ -0,0 +1,434 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: headless.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_HEADLESS_HPP
+#define EOSVIEWER_HEADLESS_HPP
+
+#include "batch_evaluation.hpp"
+#include "ModelEvaluator.hpp"
+#include "ModelView.hpp"
+#include "random_sample.hpp"
+#include "ThreadPool.hpp"
+#include "VertexSubset.hpp"
+
+#include "Eigen/Core"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * Writes a model instance as OBJ file, with per-vertex colours if a colour instance is given.
+ *
+ * The vertex colours are written as "v x y z r g b", which is what eos's core::write_obj() does as
+ * well. Writing directly from the instances avoids assembling a core::Mesh for each sample.
+ *
+ * @param[in] filename The file to write.
+ * @param[in] shape_instance The vertices, as x_0, y_0, z_0, x_1, ...
+ * @param[in] color_instance The vertex colours, as r_0, g_0, b_0, r_1, ..., or empty.
+ * @param[in] triangles The triangles, each given by three (0-based) vertex indices.
+ * @throw std::runtime_error if the file can't be written.
+ */
+inline void write_obj(const std::string& filename, const Eigen::Ref<const Eigen::VectorXf>& shape_instance,
+                      const Eigen::Ref<const Eigen::VectorXf>& color_instance,
+                      const ConstTriangleMap& triangles)
+{
+    std::ofstream file(filename);
+    if (!file)
+    {
+        throw std::runtime_error("Error opening file for writing: " + filename);
+    }
+    const bool has_colors = color_instance.size() == shape_instance.size();
+    for (Eigen::Index i = 0; i < shape_instance.size() / 3; ++i)
+    {
+        file << "v " << shape_instance(3 * i) << " " << shape_instance(3 * i + 1) << " "
+             << shape_instance(3 * i + 2);
+        if (has_colors)
+        {
+            file << " " << color_instance(3 * i) << " " << color_instance(3 * i + 1) << " "
+                 << color_instance(3 * i + 2);
+        }
+        file << "\n";
+    }
+    for (Eigen::Index i = 0; i < triangles.rows(); ++i)
+    {
+        // OBJ indices are 1-based:
+        file << "f " << triangles(i, 0) + 1 << " " << triangles(i, 1) + 1 << " " << triangles(i, 2) + 1
+             << "\n";
+    }
+    if (!file)
+    {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+};
+
+/**
+ * Settings of a headless batch sampling run.
+ */
+struct HeadlessOptions
+{
+    int num_samples = 100;
+    std::string output_dir = ".";
+    std::array<float, 3> sdev{{1.0f, 1.0f, 1.0f}}; // shp, exp, col, see draw_random_coefficients()
+    std::uint32_t seed = 0;
+    int num_threads = 0; // 0 uses the number of hardware threads
+    int batch_size = 32; // number of samples evaluated at once, 1 evaluates each sample on its own
+};
+
+/**
+ * Draws random samples of a model and writes each as OBJ file, without creating a viewer.
+ *
+ * With a batch size of 1, the samples are independent tasks, each evaluated with add_sample() on
+ * one thread, and written in parallel. With a larger batch size, batch_size samples at a time are
+ * evaluated with evaluate_batch(), with the vertices split across the threads, and then written in
+ * parallel. This streams the bases from memory once per batch instead of once per sample. The
+ * achieved GFLOP/s of the batched evaluation are reported.
+ *
+ * Each sample has its own random number generator, seeded with the seed and the sample's index, so
+ * the coefficients don't depend on the number of threads nor the batch size. The files are named
+ * sample_000000.obj, sample_000001.obj, ... in the output directory, which has to exist.
+ *
+ * @param[in] morphable_model The model to draw samples of.
+ * @param[in] options The number of samples, output directory, sdevs, seed and batch size.
+ * @param[in] log Stream to report progress and the throughput to.
+ * @return The number of samples per second.
+ * @throw std::runtime_error if a file can't be written.
+ */
+inline double run_headless(const ModelView& morphable_model,
+                           const HeadlessOptions& options, std::ostream& log)
+{
+    using clock = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+    const auto& shape_model = morphable_model.get_shape_model();
+    const auto& color_model = morphable_model.get_color_model();
+
+    ThreadPool thread_pool(options.num_threads);
+    log << "Writing " << options.num_samples << " samples to " << options.output_dir << ", on "
+        << thread_pool.get_num_threads() << " threads, in batches of " << options.batch_size << "..."
+        << std::endl;
+
+    const auto draw_coefficients = [&](int sample, std::vector<float>& shape_coefficients,
+                                       std::vector<float>& expression_coefficients,
+                                       std::vector<float>& color_coefficients) {
+        std::seed_seq seed{options.seed, static_cast<std::uint32_t>(sample)};
+        std::default_random_engine rng(seed);
+        draw_random_coefficients(morphable_model, options.sdev, rng, shape_coefficients,
+                                 expression_coefficients, color_coefficients);
+    };
+    // Exceptions must not escape a worker thread. We keep the first one, and re-throw it at the end:
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    const auto write_sample = [&](int sample, const Eigen::Ref<const Eigen::VectorXf>& shape_instance,
+                                  const Eigen::Ref<const Eigen::VectorXf>& color_instance) {
+        try
+        {
+            char filename[32];
+            std::snprintf(filename, sizeof(filename), "sample_%06d.obj", sample);
+            write_obj(options.output_dir + "/" + filename, shape_instance, color_instance,
+                      morphable_model.get_triangles());
+        } catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    const auto start = clock::now();
+    if (options.batch_size <= 1)
+    {
+        // Each sample is evaluated on one thread, so the evaluation itself runs without a pool:
+        thread_pool.parallel_for(options.num_samples, [&](std::ptrdiff_t sample) {
+            std::vector<float> shape_coefficients, expression_coefficients, color_coefficients;
+            draw_coefficients(static_cast<int>(sample), shape_coefficients, expression_coefficients,
+                              color_coefficients);
+            Eigen::VectorXf shape_instance = Eigen::VectorXf::Zero(shape_model.get_data_dimension());
+            add_sample(shape_model, shape_coefficients, shape_instance);
+            add_expression_sample(morphable_model, expression_coefficients, shape_instance);
+            Eigen::VectorXf color_instance = Eigen::VectorXf::Zero(color_model.get_data_dimension());
+            add_sample(color_model, color_coefficients, color_instance);
+            write_sample(static_cast<int>(sample), shape_instance, color_instance);
+        });
+    } else
+    {
+        std::vector<float> shape_sample, expression_sample, color_sample;
+        Eigen::MatrixXf shape_coefficients, expression_coefficients, color_coefficients;
+        Eigen::MatrixXf shape_instances, color_instances;
+        seconds evaluation_time{0.0};
+        std::int64_t num_flops = 0;
+        for (int first_sample = 0; first_sample < options.num_samples; first_sample += options.batch_size)
+        {
+            const int batch_size = std::min(options.batch_size, options.num_samples - first_sample);
+            for (int i = 0; i < batch_size; ++i)
+            {
+                draw_coefficients(first_sample + i, shape_sample, expression_sample, color_sample);
+                if (i == 0)
+                {
+                    shape_coefficients.resize(shape_sample.size(), batch_size);
+                    expression_coefficients.resize(expression_sample.size(), batch_size);
+                    color_coefficients.resize(color_sample.size(), batch_size);
+                }
+                shape_coefficients.col(i) = Eigen::Map<const Eigen::VectorXf>(shape_sample.data(),
+                                                                              shape_sample.size());
+                expression_coefficients.col(i) =
+                    Eigen::Map<const Eigen::VectorXf>(expression_sample.data(), expression_sample.size());
+                color_coefficients.col(i) = Eigen::Map<const Eigen::VectorXf>(color_sample.data(),
+                                                                              color_sample.size());
+            }
+
+            const auto evaluation_start = clock::now();
+            evaluate_batch(morphable_model, shape_coefficients, expression_coefficients,
+                           color_coefficients, shape_instances, color_instances, &thread_pool);
+            evaluation_time += clock::now() - evaluation_start;
+            num_flops += count_batch_flops(morphable_model, shape_coefficients, expression_coefficients,
+                                           color_coefficients);
+
+            thread_pool.parallel_for(batch_size, [&](std::ptrdiff_t i) {
+                write_sample(first_sample + static_cast<int>(i), shape_instances.col(i),
+                             color_instances.col(i));
+            });
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (error)
+            {
+                break;
+            }
+        }
+        if (evaluation_time.count() > 0.0)
+        {
+            log << "Batched evaluation: " << evaluation_time.count() << " s, "
+                << num_flops / evaluation_time.count() * 1e-9 << " GFLOP/s." << std::endl;
+        }
+    }
+    const seconds elapsed = clock::now() - start;
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+
+    const double samples_per_second = elapsed.count() > 0.0 ? options.num_samples / elapsed.count() : 0.0;
+    log << "Wrote " << options.num_samples << " samples in " << elapsed.count() << " s ("
+        << samples_per_second << " samples/s)." << std::endl;
+    return samples_per_second;
+};
+
+/**
+ * Draws random samples of a model, like run_headless(), but only evaluates the given landmarks (or any
+ * other vertices), and writes their positions to landmarks.csv in the output directory, one line per
+ * sample: the sample index, and x, y and z of each landmark, with a header line with the landmark names.
+ *
+ * The samples have the same coefficients as the ones of run_headless() with the same seed and sdevs, so
+ * the positions are the ones of the corresponding vertices of sample_000000.obj, ... The landmarks are
+ * evaluated with a model of only their vertices (see make_vertex_subset_model()), batch_size samples at
+ * a time. The lines of each batch are formatted in parallel.
+ *
+ * @param[in] morphable_model The model to draw samples of.
+ * @param[in] landmarks The landmarks to write, in this order.
+ * @param[in] options The number of samples, output directory, sdevs, seed and batch size.
+ * @param[in] log Stream to report the throughput to.
+ * @return The number of samples per second.
+ * @throw std::runtime_error if there are no landmarks, or landmarks.csv can't be written.
+ */
+inline double run_headless_landmarks(const ModelView& morphable_model,
+                                     const std::vector<LandmarkDefinition>& landmarks,
+                                     const HeadlessOptions& options, std::ostream& log)
+{
+    using clock = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+    const auto subset_model = make_vertex_subset_model(morphable_model, get_vertex_indices(landmarks));
+    const auto filename = options.output_dir + "/landmarks.csv";
+    std::ofstream file(filename);
+    if (!file)
+    {
+        throw std::runtime_error("Error opening file for writing: " + filename);
+    }
+    file << "sample";
+    for (const auto& landmark : landmarks)
+    {
+        file << "," << landmark.name << ".x," << landmark.name << ".y," << landmark.name << ".z";
+    }
+    file << "\n";
+
+    ThreadPool thread_pool(options.num_threads);
+    log << "Writing the positions of " << landmarks.size() << " landmarks of " << options.num_samples
+        << " samples to " << filename << "..." << std::endl;
+
+    const auto start = clock::now();
+    const int batch_size = std::max(1, options.batch_size);
+    std::vector<float> shape_sample, expression_sample, color_sample;
+    Eigen::MatrixXf shape_coefficients, expression_coefficients;
+    Eigen::MatrixXf color_coefficients; // no rows, as the colours of the landmarks aren't written
+    Eigen::MatrixXf shape_instances, color_instances;
+    std::vector<std::string> lines(batch_size);
+    seconds evaluation_time{0.0};
+    for (int first_sample = 0; first_sample < options.num_samples; first_sample += batch_size)
+    {
+        const int num_batch_samples = std::min(batch_size, options.num_samples - first_sample);
+        for (int i = 0; i < num_batch_samples; ++i)
+        {
+            // The coefficients are drawn from the full model, to be the same as run_headless()'s:
+            std::seed_seq seed{options.seed, static_cast<std::uint32_t>(first_sample + i)};
+            std::default_random_engine rng(seed);
+            draw_random_coefficients(morphable_model, options.sdev, rng, shape_sample, expression_sample,
+                                     color_sample);
+            if (i == 0)
+            {
+                shape_coefficients.resize(shape_sample.size(), num_batch_samples);
+                expression_coefficients.resize(expression_sample.size(), num_batch_samples);
+                color_coefficients.resize(0, num_batch_samples);
+            }
+            shape_coefficients.col(i) = Eigen::Map<const Eigen::VectorXf>(shape_sample.data(),
+                                                                          shape_sample.size());
+            expression_coefficients.col(i) =
+                Eigen::Map<const Eigen::VectorXf>(expression_sample.data(), expression_sample.size());
+        }
+
+        // The subset is small, so it is evaluated on one thread:
+        const auto evaluation_start = clock::now();
+        evaluate_batch(subset_model.view, shape_coefficients, expression_coefficients, color_coefficients,
+                       shape_instances, color_instances);
+        evaluation_time += clock::now() - evaluation_start;
+
+        thread_pool.parallel_for(num_batch_samples, [&](std::ptrdiff_t i) {
+            auto& line = lines[i];
+            line = std::to_string(first_sample + i);
+            char value[32];
+            for (Eigen::Index row = 0; row < shape_instances.rows(); ++row)
+            {
+                std::snprintf(value, sizeof(value), ",%g", shape_instances(row, i));
+                line += value;
+            }
+            line += "\n";
+        });
+        for (int i = 0; i < num_batch_samples; ++i)
+        {
+            file << lines[i];
+        }
+    }
+    if (!file)
+    {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+    const seconds elapsed = clock::now() - start;
+    const double samples_per_second = elapsed.count() > 0.0 ? options.num_samples / elapsed.count() : 0.0;
+    log << "Wrote the landmarks of " << options.num_samples << " samples in " << elapsed.count() << " s ("
+        << samples_per_second << " samples/s, of which evaluation: " << evaluation_time.count() << " s)."
+        << std::endl;
+    return samples_per_second;
+};
+
+/**
+ * Measures the evaluation that the viewer runs when the coefficients change, in isolation: the
+ * SpecialisedModelEvaluator for the model's kind of expression model is updated num_samples times in
+ * each of these scenarios, and the mean time per update is reported:
+ *
+ *   all parts: all coefficients change (a random face sample)
+ *   identity: the shape coefficients change, the expression stays
+ *   expression: the expression coefficients change, the identity stays (animation)
+ *   one slider: one shape coefficient changes (dragging a slider)
+ *
+ * The coefficients are drawn before the timing starts.
+ *
+ * @param[in] morphable_model The model to evaluate.
+ * @param[in] options The number of updates per scenario (num_samples), the sdevs, seed and threads.
+ * @param[in] log Stream to report the times to.
+ */
+inline void run_evaluation_benchmark(const ModelView& morphable_model, const HeadlessOptions& options,
+                                     std::ostream& log)
+{
+    using clock = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+    ThreadPool thread_pool(options.num_threads);
+    const int num_updates = std::max(1, options.num_samples);
+
+    std::default_random_engine rng(options.seed);
+    std::vector<std::vector<float>> shape_samples(num_updates), expression_samples(num_updates),
+        color_samples(num_updates);
+    for (int i = 0; i < num_updates; ++i)
+    {
+        draw_random_coefficients(morphable_model, options.sdev, rng, shape_samples[i], expression_samples[i],
+                                 color_samples[i]);
+    }
+
+    visit_expression_model(morphable_model, [&](auto expression_model) {
+        SpecialisedModelEvaluator<decltype(expression_model)> evaluator(morphable_model);
+        log << "Benchmarking the evaluation of the model with " << expression_model.name() << ", "
+            << num_updates << " updates per scenario, on " << thread_pool.get_num_threads() << " threads:"
+            << std::endl;
+        const std::array<bool, 3> all_parts{{true, true, true}};
+        evaluator.update(shape_samples[0], expression_samples[0], color_samples[0], true, all_parts,
+                         &thread_pool);
+        const auto run = [&](const char* scenario, const std::array<bool, 3>& dirty, auto&& update) {
+            const auto start = clock::now();
+            for (int i = 0; i < num_updates; ++i)
+            {
+                update(i);
+            }
+            const seconds elapsed = clock::now() - start;
+            log << "  " << scenario << ": " << elapsed.count() / num_updates * 1000.0 << " ms per update."
+                << std::endl;
+            // Go back to the first sample, so every scenario starts from the same state:
+            evaluator.update(shape_samples[0], expression_samples[0], color_samples[0], true, dirty,
+                             &thread_pool);
+        };
+        run("all parts", all_parts, [&](int i) {
+            evaluator.update(shape_samples[i], expression_samples[i], color_samples[i], true, all_parts,
+                             &thread_pool);
+        });
+        const std::array<bool, 3> shape_only{{true, false, false}};
+        run("identity", shape_only, [&](int i) {
+            evaluator.update(shape_samples[i], expression_samples[0], color_samples[0], true, shape_only,
+                             &thread_pool);
+        });
+        const std::array<bool, 3> expression_only{{false, true, false}};
+        run("expression", expression_only, [&](int i) {
+            evaluator.update(shape_samples[0], expression_samples[i], color_samples[0], true,
+                             expression_only, &thread_pool);
+        });
+        // The slider alternates between the values of the first two samples:
+        auto slider = shape_samples[0];
+        run("one slider", shape_only, [&](int i) {
+            if (!slider.empty())
+            {
+                slider[0] = shape_samples[i % 2 == 0 ? std::min(1, num_updates - 1) : 0][0];
+            }
+            evaluator.update(slider, expression_samples[0], color_samples[0], true, shape_only,
+                             &thread_pool);
+        });
+    });
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_HEADLESS_HPP */
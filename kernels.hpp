@@ -0,0 +1,680 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: kernels.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_KERNELS_HPP
+#define EOSVIEWER_KERNELS_HPP
+
+#include "half_float.hpp"
+
+#include "Eigen/Core"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// The AVX2 and AVX-512 kernels are compiled with function-level target attributes, so that the rest of the
+// program can be built for the baseline ISA (e.g. SSE2 for distribution packages), and one binary can still
+// use the wider instructions on machines that support them. This is only available with GCC and Clang on x86.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define EOSVIEWER_X86_DISPATCH 1
+#include <immintrin.h>
+#define EOSVIEWER_TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define EOSVIEWER_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define EOSVIEWER_X86_DISPATCH 0
+#endif
+
+namespace eosviewer {
+namespace kernels {
+
+/**
+ * The instruction sets that there are kernels for. Generic uses Eigen, with whatever ISA
+ * the program was compiled for.
+ */
+enum class Isa { Generic, Avx2, Avx512 };
+
+inline const char* to_string(Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::Avx2:
+        return "avx2";
+    case Isa::Avx512:
+        return "avx512";
+    default:
+        return "generic";
+    }
+};
+
+/**
+ * Computes y += A * x, with A a column-major rows x cols matrix with leading dimension lda.
+ */
+using GemvAddFunction = void (*)(const float* A, std::ptrdiff_t rows, std::ptrdiff_t cols, std::ptrdiff_t lda,
+                                 const float* x, float* y);
+
+/**
+ * Computes y += a * x, for vectors of length n.
+ */
+using AxpyFunction = void (*)(float a, const float* x, std::ptrdiff_t n, float* y);
+
+/**
+ * Computes y += A * x like GemvAddFunction, with A stored in fp16 (see BasisView.hpp).
+ */
+using GemvAddFloat16Function = void (*)(const std::uint16_t* A, std::ptrdiff_t rows, std::ptrdiff_t cols,
+                                        std::ptrdiff_t lda, const float* x, float* y);
+
+/**
+ * Computes y += A * x like GemvAddFunction, with A stored as int8 with one scale per column, i.e.
+ * y += A_int8 * diag(column_scales) * x.
+ */
+using GemvAddInt8Function = void (*)(const std::int8_t* A, std::ptrdiff_t rows, std::ptrdiff_t cols,
+                                     std::ptrdiff_t lda, const float* column_scales, const float* x,
+                                     float* y);
+
+/**
+ * Computes y += a * x like AxpyFunction, with x stored in fp16.
+ */
+using AxpyFloat16Function = void (*)(float a, const std::uint16_t* x, std::ptrdiff_t n, float* y);
+
+/**
+ * Computes y += a * x like AxpyFunction, with x stored as int8. The scale of x has to be part of a.
+ */
+using AxpyInt8Function = void (*)(float a, const std::int8_t* x, std::ptrdiff_t n, float* y);
+
+/**
+ * A set of evaluation kernels for one instruction set. The kernels for fp16 and int8 convert the
+ * elements to float as they load them, so they read two or four times less memory than the float
+ * kernels, and compute the same in float.
+ */
+struct Kernels
+{
+    Isa isa;
+    GemvAddFunction gemv_add;
+    AxpyFunction axpy;
+    GemvAddFloat16Function gemv_add_f16;
+    GemvAddInt8Function gemv_add_i8;
+    AxpyFloat16Function axpy_f16;
+    AxpyInt8Function axpy_i8;
+};
+
+// The row kernels process the rows in blocks of this size, so that the block of y that is being accumulated
+// into stays in L1 cache while all the columns are streamed past it.
+constexpr std::ptrdiff_t gemv_block_rows = 2048;
+
+/**
+ * Scalar reference implementation of y += A * x, used to validate the other kernels.
+ */
+inline void gemv_add_reference(const float* A, std::ptrdiff_t rows, std::ptrdiff_t cols, std::ptrdiff_t lda,
+                               const float* x, float* y)
+{
+    for (std::ptrdiff_t r = 0; r < rows; ++r)
+    {
+        double sum = y[r];
+        for (std::ptrdiff_t k = 0; k < cols; ++k)
+        {
+            sum += static_cast<double>(A[k * lda + r]) * x[k];
+        }
+        y[r] = static_cast<float>(sum);
+    }
+};
+
+inline void gemv_add_generic(const float* A, std::ptrdiff_t rows, std::ptrdiff_t cols, std::ptrdiff_t lda,
+                             const float* x, float* y)
+{
+    using StridedMatrixMap = Eigen::Map<const Eigen::MatrixXf, 0, Eigen::OuterStride<>>;
+    const StridedMatrixMap A_(A, rows, cols, Eigen::OuterStride<>(lda));
+    const Eigen::Map<const Eigen::VectorXf> x_(x, cols);
+    Eigen::Map<Eigen::VectorXf> y_(y, rows);
+    y_.noalias() += A_ * x_;
+};
+
+inline void axpy_generic(float a, const float* x, std::ptrdiff_t n, float* y)
+{
+    Eigen::Map<Eigen::VectorXf>(y, n) += a * Eigen::Map<const Eigen::VectorXf>(x, n);
+};
+
+inline float to_float(float value)
+{
+    return value;
+};
+
+inline float to_float(std::uint16_t value)
+{
+    return half_to_float(value);
+};
+
+inline float to_float(std::int8_t value)
+{
+    return static_cast<float>(value);
+};
+
+/**
+ * Scalar y += A * diag(column_scales) * x for fp16 and int8 matrices. If column_scales is nullptr,
+ * the scales are 1.
+ */
+template <class Element>
+inline void gemv_add_generic(const Element* A, std::ptrdiff_t rows, std::ptrdiff_t cols, std::ptrdiff_t lda,
+                             const float* column_scales, const float* x, float* y)
+{
+    for (std::ptrdiff_t k = 0; k < cols; ++k)
+    {
+        const float x_k = column_scales ? x[k] * column_scales[k] : x[k];
+        const Element* a = A + k * lda;
+        for (std::ptrdiff_t r = 0; r < rows; ++r)
+        {
+            y[r] += to_float(a[r]) * x_k;
+        }
+    }
+};
+
+inline void gemv_add_f16_generic(const std::uint16_t* A, std::ptrdiff_t rows, std::ptrdiff_t cols,
+                                 std::ptrdiff_t lda, const float* x, float* y)
+{
+    gemv_add_generic(A, rows, cols, lda, nullptr, x, y);
+};
+
+inline void gemv_add_i8_generic(const std::int8_t* A, std::ptrdiff_t rows, std::ptrdiff_t cols,
+                                std::ptrdiff_t lda, const float* column_scales, const float* x, float* y)
+{
+    gemv_add_generic(A, rows, cols, lda, column_scales, x, y);
+};
+
+template <class Element>
+inline void axpy_generic(float a, const Element* x, std::ptrdiff_t n, float* y)
+{
+    for (std::ptrdiff_t i = 0; i < n; ++i)
+    {
+        y[i] += a * to_float(x[i]);
+    }
+};
+
+#if EOSVIEWER_X86_DISPATCH
+// The SIMD kernels below handle the rows that don't fill a whole register with std::fma, in the same order
+// as the vector lanes. So each row gets exactly the same sequence of operations, no matter how the rows are
+// split up into blocks or between threads, and the results are bit-identical for any split.
+
+// The kernels are written once for all element types, and a loader converts a register's worth of
+// elements to floats. The multiplier of column k is x[k], times the column's scale for int8.
+
+struct Float32Avx2
+{
+    using Element = float;
+    EOSVIEWER_TARGET_AVX2 static __m256 load(const float* a)
+    {
+        return _mm256_loadu_ps(a);
+    };
+};
+
+struct Float16Avx2
+{
+    using Element = std::uint16_t;
+    EOSVIEWER_TARGET_AVX2 static __m256 load(const std::uint16_t* a)
+    {
+        return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)));
+    };
+};
+
+struct Int8Avx2
+{
+    using Element = std::int8_t;
+    EOSVIEWER_TARGET_AVX2 static __m256 load(const std::int8_t* a)
+    {
+        return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a))));
+    };
+};
+
+template <class Loader>
+EOSVIEWER_TARGET_AVX2 inline void gemv_add_avx2_kernel(const typename Loader::Element* A, std::ptrdiff_t rows,
+                                                       std::ptrdiff_t cols, std::ptrdiff_t lda,
+                                                       const float* column_scales, const float* x, float* y)
+{
+    using Element = typename Loader::Element;
+    const auto multiplier = [column_scales, x](std::ptrdiff_t k) {
+        return column_scales ? x[k] * column_scales[k] : x[k];
+    };
+    for (std::ptrdiff_t block_begin = 0; block_begin < rows; block_begin += gemv_block_rows)
+    {
+        const std::ptrdiff_t block_end = std::min(rows, block_begin + gemv_block_rows);
+        std::ptrdiff_t k = 0;
+        for (; k + 4 <= cols; k += 4)
+        {
+            const Element* a0 = A + k * lda;
+            const Element* a1 = a0 + lda;
+            const Element* a2 = a1 + lda;
+            const Element* a3 = a2 + lda;
+            const float m0 = multiplier(k);
+            const float m1 = multiplier(k + 1);
+            const float m2 = multiplier(k + 2);
+            const float m3 = multiplier(k + 3);
+            const __m256 x0 = _mm256_set1_ps(m0);
+            const __m256 x1 = _mm256_set1_ps(m1);
+            const __m256 x2 = _mm256_set1_ps(m2);
+            const __m256 x3 = _mm256_set1_ps(m3);
+            std::ptrdiff_t r = block_begin;
+            for (; r + 8 <= block_end; r += 8)
+            {
+                __m256 acc = _mm256_loadu_ps(y + r);
+                acc = _mm256_fmadd_ps(Loader::load(a0 + r), x0, acc);
+                acc = _mm256_fmadd_ps(Loader::load(a1 + r), x1, acc);
+                acc = _mm256_fmadd_ps(Loader::load(a2 + r), x2, acc);
+                acc = _mm256_fmadd_ps(Loader::load(a3 + r), x3, acc);
+                _mm256_storeu_ps(y + r, acc);
+            }
+            for (; r < block_end; ++r)
+            {
+                float acc = y[r];
+                acc = std::fma(to_float(a0[r]), m0, acc);
+                acc = std::fma(to_float(a1[r]), m1, acc);
+                acc = std::fma(to_float(a2[r]), m2, acc);
+                acc = std::fma(to_float(a3[r]), m3, acc);
+                y[r] = acc;
+            }
+        }
+        for (; k < cols; ++k)
+        {
+            const Element* a0 = A + k * lda;
+            const float m0 = multiplier(k);
+            const __m256 x0 = _mm256_set1_ps(m0);
+            std::ptrdiff_t r = block_begin;
+            for (; r + 8 <= block_end; r += 8)
+            {
+                _mm256_storeu_ps(y + r, _mm256_fmadd_ps(Loader::load(a0 + r), x0, _mm256_loadu_ps(y + r)));
+            }
+            for (; r < block_end; ++r)
+            {
+                y[r] = std::fma(to_float(a0[r]), m0, y[r]);
+            }
+        }
+    }
+};
+
+template <class Loader>
+EOSVIEWER_TARGET_AVX2 inline void axpy_avx2_kernel(float a, const typename Loader::Element* x,
+                                                   std::ptrdiff_t n, float* y)
+{
+    const __m256 a_ = _mm256_set1_ps(a);
+    std::ptrdiff_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(Loader::load(x + i), a_, _mm256_loadu_ps(y + i)));
+    }
+    for (; i < n; ++i)
+    {
+        y[i] = std::fma(to_float(x[i]), a, y[i]);
+    }
+};
+
+struct Float32Avx512
+{
+    using Element = float;
+    EOSVIEWER_TARGET_AVX512 static __m512 load(const float* a)
+    {
+        return _mm512_loadu_ps(a);
+    };
+};
+
+struct Float16Avx512
+{
+    using Element = std::uint16_t;
+    EOSVIEWER_TARGET_AVX512 static __m512 load(const std::uint16_t* a)
+    {
+        return _mm512_cvtph_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)));
+    };
+};
+
+struct Int8Avx512
+{
+    using Element = std::int8_t;
+    EOSVIEWER_TARGET_AVX512 static __m512 load(const std::int8_t* a)
+    {
+        return _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a))));
+    };
+};
+
+template <class Loader>
+EOSVIEWER_TARGET_AVX512 inline void gemv_add_avx512_kernel(const typename Loader::Element* A,
+                                                           std::ptrdiff_t rows, std::ptrdiff_t cols,
+                                                           std::ptrdiff_t lda, const float* column_scales,
+                                                           const float* x, float* y)
+{
+    using Element = typename Loader::Element;
+    const auto multiplier = [column_scales, x](std::ptrdiff_t k) {
+        return column_scales ? x[k] * column_scales[k] : x[k];
+    };
+    for (std::ptrdiff_t block_begin = 0; block_begin < rows; block_begin += gemv_block_rows)
+    {
+        const std::ptrdiff_t block_end = std::min(rows, block_begin + gemv_block_rows);
+        std::ptrdiff_t k = 0;
+        for (; k + 4 <= cols; k += 4)
+        {
+            const Element* a0 = A + k * lda;
+            const Element* a1 = a0 + lda;
+            const Element* a2 = a1 + lda;
+            const Element* a3 = a2 + lda;
+            const float m0 = multiplier(k);
+            const float m1 = multiplier(k + 1);
+            const float m2 = multiplier(k + 2);
+            const float m3 = multiplier(k + 3);
+            const __m512 x0 = _mm512_set1_ps(m0);
+            const __m512 x1 = _mm512_set1_ps(m1);
+            const __m512 x2 = _mm512_set1_ps(m2);
+            const __m512 x3 = _mm512_set1_ps(m3);
+            std::ptrdiff_t r = block_begin;
+            for (; r + 16 <= block_end; r += 16)
+            {
+                __m512 acc = _mm512_loadu_ps(y + r);
+                acc = _mm512_fmadd_ps(Loader::load(a0 + r), x0, acc);
+                acc = _mm512_fmadd_ps(Loader::load(a1 + r), x1, acc);
+                acc = _mm512_fmadd_ps(Loader::load(a2 + r), x2, acc);
+                acc = _mm512_fmadd_ps(Loader::load(a3 + r), x3, acc);
+                _mm512_storeu_ps(y + r, acc);
+            }
+            for (; r < block_end; ++r)
+            {
+                float acc = y[r];
+                acc = std::fma(to_float(a0[r]), m0, acc);
+                acc = std::fma(to_float(a1[r]), m1, acc);
+                acc = std::fma(to_float(a2[r]), m2, acc);
+                acc = std::fma(to_float(a3[r]), m3, acc);
+                y[r] = acc;
+            }
+        }
+        for (; k < cols; ++k)
+        {
+            const Element* a0 = A + k * lda;
+            const float m0 = multiplier(k);
+            const __m512 x0 = _mm512_set1_ps(m0);
+            std::ptrdiff_t r = block_begin;
+            for (; r + 16 <= block_end; r += 16)
+            {
+                _mm512_storeu_ps(y + r, _mm512_fmadd_ps(Loader::load(a0 + r), x0, _mm512_loadu_ps(y + r)));
+            }
+            for (; r < block_end; ++r)
+            {
+                y[r] = std::fma(to_float(a0[r]), m0, y[r]);
+            }
+        }
+    }
+};
+
+template <class Loader>
+EOSVIEWER_TARGET_AVX512 inline void axpy_avx512_kernel(float a, const typename Loader::Element* x,
+                                                       std::ptrdiff_t n, float* y)
+{
+    const __m512 a_ = _mm512_set1_ps(a);
+    std::ptrdiff_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(Loader::load(x + i), a_, _mm512_loadu_ps(y + i)));
+    }
+    for (; i < n; ++i)
+    {
+        y[i] = std::fma(to_float(x[i]), a, y[i]);
+    }
+};
+
+// The float and fp16 kernels have no column scales:
+
+EOSVIEWER_TARGET_AVX2 inline void gemv_add_avx2(const float* A, std::ptrdiff_t rows, std::ptrdiff_t cols,
+                                                std::ptrdiff_t lda, const float* x, float* y)
+{
+    gemv_add_avx2_kernel<Float32Avx2>(A, rows, cols, lda, nullptr, x, y);
+};
+
+EOSVIEWER_TARGET_AVX2 inline void gemv_add_f16_avx2(const std::uint16_t* A, std::ptrdiff_t rows,
+                                                    std::ptrdiff_t cols, std::ptrdiff_t lda, const float* x,
+                                                    float* y)
+{
+    gemv_add_avx2_kernel<Float16Avx2>(A, rows, cols, lda, nullptr, x, y);
+};
+
+EOSVIEWER_TARGET_AVX512 inline void gemv_add_avx512(const float* A, std::ptrdiff_t rows, std::ptrdiff_t cols,
+                                                    std::ptrdiff_t lda, const float* x, float* y)
+{
+    gemv_add_avx512_kernel<Float32Avx512>(A, rows, cols, lda, nullptr, x, y);
+};
+
+EOSVIEWER_TARGET_AVX512 inline void gemv_add_f16_avx512(const std::uint16_t* A, std::ptrdiff_t rows,
+                                                        std::ptrdiff_t cols, std::ptrdiff_t lda,
+                                                        const float* x, float* y)
+{
+    gemv_add_avx512_kernel<Float16Avx512>(A, rows, cols, lda, nullptr, x, y);
+};
+#endif
+
+/**
+ * Returns whether the CPU we're running on supports the given instruction set.
+ */
+inline bool is_supported(Isa isa)
+{
+#if EOSVIEWER_X86_DISPATCH
+    switch (isa)
+    {
+    case Isa::Avx2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+               __builtin_cpu_supports("f16c");
+    case Isa::Avx512:
+        return __builtin_cpu_supports("avx512f");
+    default:
+        return true;
+    }
+#else
+    return isa == Isa::Generic;
+#endif
+};
+
+/**
+ * Returns the kernels for the given instruction set. The caller has to check is_supported()
+ * first.
+ */
+inline Kernels make_kernels(Isa isa)
+{
+#if EOSVIEWER_X86_DISPATCH
+    if (isa == Isa::Avx512)
+    {
+        return Kernels{Isa::Avx512,
+                       &gemv_add_avx512,
+                       &axpy_avx512_kernel<Float32Avx512>,
+                       &gemv_add_f16_avx512,
+                       &gemv_add_avx512_kernel<Int8Avx512>,
+                       &axpy_avx512_kernel<Float16Avx512>,
+                       &axpy_avx512_kernel<Int8Avx512>};
+    }
+    if (isa == Isa::Avx2)
+    {
+        return Kernels{Isa::Avx2,
+                       &gemv_add_avx2,
+                       &axpy_avx2_kernel<Float32Avx2>,
+                       &gemv_add_f16_avx2,
+                       &gemv_add_avx2_kernel<Int8Avx2>,
+                       &axpy_avx2_kernel<Float16Avx2>,
+                       &axpy_avx2_kernel<Int8Avx2>};
+    }
+#endif
+    return Kernels{Isa::Generic,
+                   &gemv_add_generic,
+                   &axpy_generic,
+                   &gemv_add_f16_generic,
+                   &gemv_add_i8_generic,
+                   &axpy_generic<std::uint16_t>,
+                   &axpy_generic<std::int8_t>};
+};
+
+/**
+ * Returns the widest instruction set that the CPU supports.
+ */
+inline Isa detect_isa()
+{
+    if (is_supported(Isa::Avx512))
+    {
+        return Isa::Avx512;
+    }
+    if (is_supported(Isa::Avx2))
+    {
+        return Isa::Avx2;
+    }
+    return Isa::Generic;
+};
+
+namespace detail {
+inline Kernels& active_kernels()
+{
+    static Kernels kernels = make_kernels(detect_isa());
+    return kernels;
+};
+} /* namespace detail */
+
+/**
+ * Returns the kernels that are used for evaluating models. On the first call, these are
+ * selected by detecting the CPU's features.
+ */
+inline const Kernels& get_kernels()
+{
+    return detail::active_kernels();
+};
+
+/**
+ * Overrides the automatically selected kernels, e.g. to compare their speed. Must not be
+ * called while another thread is evaluating a model.
+ *
+ * @param[in] isa The instruction set to use.
+ * @return Whether the CPU supports \p isa. If not, the kernels are not changed.
+ */
+inline bool select_kernels(Isa isa)
+{
+    if (!is_supported(isa))
+    {
+        return false;
+    }
+    detail::active_kernels() = make_kernels(isa);
+    return true;
+};
+
+/**
+ * Runs all the kernels that the CPU supports on random data, and compares their results with
+ * the scalar reference implementation. Sizes that aren't multiples of the register width or
+ * of the column unrolling are included, to exercise the remainder loops. The fp16 and int8
+ * kernels are compared with the reference on the dequantized matrix.
+ *
+ * @param[in] out Stream to write a line per instruction set to.
+ * @return Whether all the kernels are within the tolerance.
+ */
+inline bool validate_kernels(std::ostream& out)
+{
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    const std::vector<std::ptrdiff_t> test_rows = {1, 7, 33, 3 * 5023, 3 * gemv_block_rows + 5};
+    const std::vector<std::ptrdiff_t> test_cols = {1, 3, 4, 13, 64};
+
+    bool all_passed = true;
+    for (const Isa isa : {Isa::Generic, Isa::Avx2, Isa::Avx512})
+    {
+        if (!is_supported(isa))
+        {
+            out << to_string(isa) << ": not supported by this CPU" << std::endl;
+            continue;
+        }
+        const Kernels kernels = make_kernels(isa);
+        float max_error = 0.0f;
+        for (const auto rows : test_rows)
+        {
+            for (const auto cols : test_cols)
+            {
+                const std::ptrdiff_t lda = rows + 3; // a leading dimension larger than rows
+                std::vector<float> A(lda * cols), x(cols), y(rows);
+                const auto fill_random = [&](std::vector<float>& values) {
+                    std::for_each(begin(values), end(values), [&](auto& value) { value = dist(rng); });
+                };
+                fill_random(A);
+                fill_random(x);
+                fill_random(y);
+                // The same matrix in fp16, and in int8 with scales that keep the products in [-1, 1],
+                // and both dequantized, to compute the references with:
+                std::vector<std::uint16_t> A_f16(A.size());
+                std::vector<std::int8_t> A_i8(A.size());
+                std::vector<float> A_f16_dequantized(A.size()), A_i8_dequantized(A.size());
+                for (std::size_t i = 0; i < A.size(); ++i)
+                {
+                    A_f16[i] = float_to_half(A[i]);
+                    A_f16_dequantized[i] = half_to_float(A_f16[i]);
+                    A_i8[i] = static_cast<std::int8_t>(std::lround(A[i] * 127.0f));
+                    A_i8_dequantized[i] = A_i8[i];
+                }
+                std::vector<float> column_scales(cols), x_scaled(cols);
+                for (std::ptrdiff_t k = 0; k < cols; ++k)
+                {
+                    column_scales[k] = std::abs(dist(rng)) / 127.0f;
+                    x_scaled[k] = x[k] * column_scales[k];
+                }
+                const std::vector<float> y_initial = y;
+                std::vector<float> y_reference = y;
+                std::vector<float> y_f16 = y, y_f16_reference = y;
+                std::vector<float> y_i8 = y, y_i8_reference = y;
+                std::vector<float> y_axpy = y, y_axpy_f16 = y, y_axpy_i8 = y;
+
+                kernels.gemv_add(A.data(), rows, cols, lda, x.data(), y.data());
+                gemv_add_reference(A.data(), rows, cols, lda, x.data(), y_reference.data());
+                kernels.gemv_add_f16(A_f16.data(), rows, cols, lda, x.data(), y_f16.data());
+                gemv_add_reference(A_f16_dequantized.data(), rows, cols, lda, x.data(),
+                                   y_f16_reference.data());
+                kernels.gemv_add_i8(A_i8.data(), rows, cols, lda, column_scales.data(), x.data(),
+                                    y_i8.data());
+                gemv_add_reference(A_i8_dequantized.data(), rows, cols, lda, x_scaled.data(),
+                                   y_i8_reference.data());
+                kernels.axpy(x[0], A.data(), rows, y_axpy.data());
+                kernels.axpy_f16(x[0], A_f16.data(), rows, y_axpy_f16.data());
+                kernels.axpy_i8(x_scaled[0], A_i8.data(), rows, y_axpy_i8.data());
+                for (std::ptrdiff_t i = 0; i < rows; ++i)
+                {
+                    // Each element is a sum of cols products of values in [-1, 1]:
+                    const float tolerance = 1e-5f * (cols + 1);
+                    max_error = std::max(max_error, std::abs(y[i] - y_reference[i]) / tolerance);
+                    max_error = std::max(max_error, std::abs(y_f16[i] - y_f16_reference[i]) / tolerance);
+                    max_error = std::max(max_error, std::abs(y_i8[i] - y_i8_reference[i]) / tolerance);
+                    const float axpy_results[] = {y_axpy[i], y_axpy_f16[i], y_axpy_i8[i]};
+                    const float axpy_references[] = {y_initial[i] + x[0] * A[i],
+                                                     y_initial[i] + x[0] * A_f16_dequantized[i],
+                                                     y_initial[i] + x_scaled[0] * A_i8_dequantized[i]};
+                    for (int j = 0; j < 3; ++j)
+                    {
+                        max_error =
+                            std::max(max_error, std::abs(axpy_results[j] - axpy_references[j]) / 1e-5f);
+                    }
+                }
+            }
+        }
+        const bool passed = max_error <= 1.0f;
+        out << to_string(isa) << ": " << (passed ? "passed" : "FAILED")
+            << " (max error relative to tolerance: " << max_error << ")" << std::endl;
+        all_passed = all_passed && passed;
+    }
+    return all_passed;
+};
+
+} /* namespace kernels */
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_KERNELS_HPP */
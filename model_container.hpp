@@ -0,0 +1,737 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: model_container.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_MODEL_CONTAINER_HPP
+#define EOSVIEWER_MODEL_CONTAINER_HPP
+
+#include "BasisView.hpp"
+#include "LoadedModel.hpp"
+#include "LoadProgress.hpp"
+#include "MappedFile.hpp"
+#include "ModelView.hpp"
+#include "ThreadPool.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * The native model container (.eosm) is a file that can be memory-mapped and used in place:
+ *
+ *   header (64 bytes) | section table (32 bytes per section) | sections
+ *
+ * Each section holds one array of the model, in exactly the layout of the corresponding ModelView
+ * member (column-major matrices, row-major triangles and texture coordinates), and the bases may be
+ * stored in a lower precision (see ElementType). Every section starts at a multiple of
+ * container_alignment bytes, so the arrays are aligned to cache lines and to the widest SIMD registers.
+ * All values are stored in the byte order of the machine that wrote the file, which is checked on load.
+ *
+ * Only what the viewer needs is stored: the means, rescaled bases and eigenvalues, the packed
+ * blendshapes, the triangle list, the texture coordinates and the landmark definitions.
+ *
+ * Version 2 added the landmark definitions. Version 1 files are rejected (and cache entries rebuilt), as
+ * they would silently load without landmarks.
+ */
+namespace container {
+
+const char magic[8] = {'E', 'O', 'S', 'M', 'O', 'D', 'E', 'L'};
+const std::uint32_t version = 2;
+const std::uint32_t byte_order_mark = 0x01020304;
+const std::size_t container_alignment = 64;
+
+enum class SectionId : std::uint32_t {
+    ShapeMean = 1,
+    ShapeBasis,
+    ShapeEigenvalues,
+    ColorMean,
+    ColorBasis,
+    ColorEigenvalues,
+    ExpressionMean,
+    ExpressionBasis,
+    ExpressionEigenvalues,
+    Blendshapes,
+    Triangles,
+    TextureCoordinates,
+    ShapeBasisScales, // the column scales of an Int8 basis
+    ColorBasisScales,
+    ExpressionBasisScales,
+    BlendshapesScales,
+    LandmarkVertices, // Int32, one per landmark
+    LandmarkNames     // Char, the '\0'-terminated names of the landmarks, one after another
+};
+const std::uint32_t num_section_ids = 19; // one more than the largest SectionId
+
+// The bases and the blendshapes can be stored as Float16 or Int8 (see BasisPrecision). An Int8 basis has
+// a scales section with one Float32 per column.
+enum class ElementType : std::uint32_t { Float32 = 1, Int32 = 2, Float16 = 3, Int8 = 4, Char = 5 };
+
+inline std::uint64_t get_element_size(ElementType type)
+{
+    switch (type)
+    {
+    case ElementType::Float16:
+        return 2;
+    case ElementType::Int8:
+    case ElementType::Char:
+        return 1;
+    default:
+        return 4;
+    }
+};
+
+inline ElementType to_element_type(BasisPrecision precision)
+{
+    switch (precision)
+    {
+    case BasisPrecision::Float16:
+        return ElementType::Float16;
+    case BasisPrecision::Int8:
+        return ElementType::Int8;
+    default:
+        return ElementType::Float32;
+    }
+};
+
+inline BasisPrecision to_basis_precision(ElementType type)
+{
+    switch (type)
+    {
+    case ElementType::Float16:
+        return BasisPrecision::Float16;
+    case ElementType::Int8:
+        return BasisPrecision::Int8;
+    default:
+        return BasisPrecision::Float32;
+    }
+};
+
+inline bool is_basis(std::uint32_t id)
+{
+    return id == static_cast<std::uint32_t>(SectionId::ShapeBasis) ||
+           id == static_cast<std::uint32_t>(SectionId::ColorBasis) ||
+           id == static_cast<std::uint32_t>(SectionId::ExpressionBasis) ||
+           id == static_cast<std::uint32_t>(SectionId::Blendshapes);
+};
+
+struct Header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order_mark;
+    std::uint64_t num_sections;
+    std::uint64_t section_table_offset;
+    std::uint64_t file_size;
+    std::uint8_t reserved[24];
+};
+static_assert(sizeof(Header) == 64, "The container header has to be 64 bytes.");
+
+struct Section
+{
+    std::uint32_t id;           // a SectionId
+    std::uint32_t element_type; // an ElementType
+    std::uint64_t offset;       // from the start of the file
+    std::uint64_t rows;
+    std::uint64_t cols;
+};
+static_assert(sizeof(Section) == 32, "A container section table entry has to be 32 bytes.");
+
+inline std::uint64_t get_element_size(const Section& section)
+{
+    return get_element_size(static_cast<ElementType>(section.element_type));
+};
+
+inline std::uint64_t align(std::uint64_t offset)
+{
+    return (offset + container_alignment - 1) / container_alignment * container_alignment;
+};
+
+/**
+ * Returns whether the given first bytes of a file are those of a model container.
+ */
+inline bool has_magic(const unsigned char* data, std::size_t size)
+{
+    return size >= sizeof(magic) && std::memcmp(data, magic, sizeof(magic)) == 0;
+};
+
+} /* namespace container */
+
+/**
+ * The number of principal components (and blendshapes) of each model that load_model_container() makes
+ * resident by default before it returns. These are about the sliders that the viewer shows first.
+ * The evaluation only reads the columns up to the last non-zero coefficient, so the others are paged
+ * in once their slider is moved (or a random sample is drawn, which pages in all of them).
+ */
+const int default_num_resident_components = 30;
+
+namespace detail {
+
+/**
+ * A range of bytes of a file.
+ */
+struct ByteRange
+{
+    std::uint64_t offset;
+    std::uint64_t length;
+};
+
+// Ranges are read in chunks of this many bytes, so that the progress can be reported, and stopping the
+// background thread doesn't have to wait for a whole basis to be read:
+const std::uint64_t fault_in_chunk_size = 4 * 1024 * 1024;
+
+/**
+ * The storage of a model that has been loaded from a native model container: the mapping of the file,
+ * and a thread that reads parts of it into memory in the background. The thread is stopped when the
+ * storage is released.
+ */
+class MappedContainerStorage
+{
+public:
+    explicit MappedContainerStorage(const std::string& filename) : file(filename){};
+
+    ~MappedContainerStorage()
+    {
+        stop = true;
+        if (prefetcher.joinable())
+        {
+            prefetcher.join();
+        }
+    };
+
+    MappedContainerStorage(const MappedContainerStorage&) = delete;
+    MappedContainerStorage& operator=(const MappedContainerStorage&) = delete;
+
+    const MappedFile& get_file() const
+    {
+        return file;
+    };
+
+    /**
+     * Starts a thread that reads the given ranges of the file into memory, in order, a chunk at a
+     * time. Can only be called once.
+     *
+     * @param[in] ranges The ranges to read.
+     */
+    void fault_in_background(std::vector<ByteRange> ranges)
+    {
+        prefetcher = std::thread([this, ranges]() {
+            trace::set_thread_name("container prefetcher");
+            trace::Span span("read sections in background");
+            for (const auto& range : ranges)
+            {
+                for (std::uint64_t done = 0; done < range.length; done += fault_in_chunk_size)
+                {
+                    if (stop)
+                    {
+                        return;
+                    }
+                    const auto length = std::min(fault_in_chunk_size, range.length - done);
+                    file.prefetch(range.offset + done, length);
+                    file.fault_in(range.offset + done, length);
+                }
+            }
+        });
+    };
+
+private:
+    MappedFile file;
+    std::atomic<bool> stop{false};
+    std::thread prefetcher;
+};
+
+} /* namespace detail */
+
+/**
+ * Writes the given model as native model container, which can then be loaded with
+ * load_model_container().
+ *
+ * @param[in] filename The file to write, usually with extension .eosm.
+ * @param[in] model The model to write.
+ * @return The size of the written file in bytes.
+ * @throw std::runtime_error if the file can't be written.
+ */
+inline std::uint64_t write_model_container(const std::string& filename, const ModelView& model)
+{
+    using namespace container;
+    trace::Span span("write model container");
+    struct SectionData
+    {
+        Section section;
+        const void* data;
+    };
+    std::vector<SectionData> sections;
+    const auto add_section = [&sections](SectionId id, ElementType type, const void* data, std::uint64_t rows,
+                                         std::uint64_t cols) {
+        if (rows * cols > 0)
+        {
+            const Section section{static_cast<std::uint32_t>(id), static_cast<std::uint32_t>(type), 0, rows,
+                                  cols};
+            sections.push_back({section, data});
+        }
+    };
+    const auto add_basis = [&add_section](const BasisView& basis, SectionId id, SectionId scales_id) {
+        add_section(id, to_element_type(basis.precision), basis.data, basis.rows, basis.cols);
+        if (basis.precision == BasisPrecision::Int8)
+        {
+            add_section(scales_id, ElementType::Float32, basis.column_scales, basis.cols, 1);
+        }
+    };
+    const auto add_pca_model = [&add_section, &add_basis](const PcaModelView& pca_model, SectionId mean,
+                                                          SectionId basis, SectionId eigenvalues,
+                                                          SectionId scales) {
+        const auto dimension = pca_model.get_data_dimension();
+        const auto num_components = pca_model.get_num_principal_components();
+        add_section(mean, ElementType::Float32, pca_model.mean, dimension, 1);
+        add_basis(pca_model.get_rescaled_pca_basis(), basis, scales);
+        add_section(eigenvalues, ElementType::Float32, pca_model.eigenvalues, num_components, 1);
+    };
+    add_pca_model(model.shape_model, SectionId::ShapeMean, SectionId::ShapeBasis, SectionId::ShapeEigenvalues,
+                  SectionId::ShapeBasisScales);
+    add_pca_model(model.color_model, SectionId::ColorMean, SectionId::ColorBasis, SectionId::ColorEigenvalues,
+                  SectionId::ColorBasisScales);
+    if (model.expression_model_type == ExpressionModelType::PcaModel)
+    {
+        add_pca_model(model.expression_pca_model, SectionId::ExpressionMean, SectionId::ExpressionBasis,
+                      SectionId::ExpressionEigenvalues, SectionId::ExpressionBasisScales);
+    } else if (model.expression_model_type == ExpressionModelType::Blendshapes)
+    {
+        add_basis(model.get_expression_basis(), SectionId::Blendshapes, SectionId::BlendshapesScales);
+    }
+    add_section(SectionId::Triangles, ElementType::Int32, model.triangles, model.num_triangles, 3);
+    add_section(SectionId::TextureCoordinates, ElementType::Float32, model.texture_coordinates,
+                model.num_texture_coordinates, 2);
+    add_section(SectionId::LandmarkVertices, ElementType::Int32, model.landmark_vertices, model.num_landmarks,
+                1);
+    add_section(SectionId::LandmarkNames, ElementType::Char, model.landmark_names, model.landmark_names_size,
+                1);
+
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.byte_order_mark = byte_order_mark;
+    header.num_sections = sections.size();
+    header.section_table_offset = sizeof(Header);
+    std::uint64_t offset = align(sizeof(Header) + sections.size() * sizeof(Section));
+    const auto get_size = [](const Section& section) {
+        return section.rows * section.cols * get_element_size(section);
+    };
+    for (auto& section : sections)
+    {
+        section.section.offset = offset;
+        offset = align(offset + get_size(section.section));
+    }
+    header.file_size = offset;
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Error opening file for writing: " + filename);
+    }
+    const char padding[container_alignment] = {};
+    const auto pad_to = [&file, &padding](std::uint64_t position) {
+        const auto current_position = static_cast<std::uint64_t>(file.tellp());
+        file.write(padding, static_cast<std::streamsize>(position - current_position));
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto& section : sections)
+    {
+        file.write(reinterpret_cast<const char*>(&section.section), sizeof(Section));
+    }
+    for (const auto& section : sections)
+    {
+        pad_to(section.section.offset);
+        file.write(static_cast<const char*>(section.data),
+                   static_cast<std::streamsize>(get_size(section.section)));
+    }
+    pad_to(header.file_size);
+    if (!file)
+    {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+    return header.file_size;
+};
+
+/**
+ * Maps a native model container into memory, and returns a view on it. Nothing is copied: the
+ * arrays of the view point directly into the mapping. The mapping stays alive as long as the storage
+ * of the returned model.
+ *
+ * Only the first num_resident_components columns of each basis (and of the blendshapes) are read from
+ * disk before this returns, together with the means, eigenvalues, triangles, texture coordinates and
+ * landmarks. As the bases are stored column by column, these are the first bytes of each basis. The
+ * remaining columns are read by a background thread, and if they are accessed before that thread has
+ * got to them, they are paged in on demand by the OS. So the time until a model can be displayed depends on
+ * the number of components that are shown, and not on the size of the model.
+ *
+ * The header and section table are validated, as well as the dimensions of all arrays, the
+ * triangle indices (which reads the triangle list) and the landmark definitions, so that a truncated
+ * or inconsistent file is rejected here and not when the model is evaluated.
+ *
+ * @param[in] filename The .eosm file to load.
+ * @param[in,out] progress If given, the number of sections that have been validated is reported here,
+ *                         and the number of bytes that have been read, of the ones made resident.
+ * The sections are independent of each other, so if a thread pool is given, they are read (in chunks)
+ * and validated in parallel.
+ *
+ * @param[in] num_resident_components The number of components to read before returning. If negative,
+ *                                    the whole model is read before returning.
+ * @param[in] thread_pool If given, the sections are read and validated in parallel on this pool.
+ * @return The loaded model.
+ * @throw std::runtime_error if the file can't be mapped, or isn't a valid container.
+ */
+inline LoadedModel load_model_container(const std::string& filename, LoadProgress* progress = nullptr,
+                                        int num_resident_components = default_num_resident_components,
+                                        ThreadPool* thread_pool = nullptr)
+{
+    using namespace container;
+    trace::Span span("load model container");
+    auto storage = std::make_shared<detail::MappedContainerStorage>(filename);
+    const MappedFile* file = &storage->get_file();
+    const auto fail = [&filename](const std::string& reason) {
+        throw std::runtime_error("Error loading model container " + filename + ": " + reason);
+    };
+
+    Header header;
+    if (file->size() < sizeof(Header))
+    {
+        fail("The file is too small.");
+    }
+    std::memcpy(&header, file->data(), sizeof(Header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+    {
+        fail("The file is not an eos model container.");
+    }
+    if (header.byte_order_mark != byte_order_mark)
+    {
+        fail("The file has been written on a machine with a different byte order.");
+    }
+    if (header.version != version)
+    {
+        fail("Unsupported container version " + std::to_string(header.version) + ".");
+    }
+    if (header.file_size != file->size() ||
+        header.section_table_offset + header.num_sections * sizeof(Section) > file->size())
+    {
+        fail("The file is truncated.");
+    }
+    if (progress)
+    {
+        progress->sections_total += static_cast<int>(header.num_sections);
+    }
+
+    // Collect the sections, indexed by their id. An offset of 0 (the header) marks a missing section.
+    std::array<Section, num_section_ids> sections{};
+    for (std::uint64_t i = 0; i < header.num_sections; ++i)
+    {
+        Section section;
+        std::memcpy(&section, file->data() + header.section_table_offset + i * sizeof(Section),
+                    sizeof(Section));
+        auto expected_type = ElementType::Float32;
+        if (section.id == static_cast<std::uint32_t>(SectionId::Triangles) ||
+            section.id == static_cast<std::uint32_t>(SectionId::LandmarkVertices))
+        {
+            expected_type = ElementType::Int32;
+        } else if (section.id == static_cast<std::uint32_t>(SectionId::LandmarkNames))
+        {
+            expected_type = ElementType::Char;
+        }
+        const bool is_quantized = section.element_type == static_cast<std::uint32_t>(ElementType::Float16) ||
+                                  section.element_type == static_cast<std::uint32_t>(ElementType::Int8);
+        const bool type_is_valid = section.element_type == static_cast<std::uint32_t>(expected_type) ||
+                                   (is_basis(section.id) && is_quantized);
+        if (!type_is_valid || section.offset == 0 || section.offset % container_alignment != 0 ||
+            section.offset > file->size() || section.rows > std::numeric_limits<int>::max() ||
+            section.cols > std::numeric_limits<int>::max() ||
+            section.rows * section.cols > (file->size() - section.offset) / get_element_size(section))
+        {
+            fail("Section " + std::to_string(section.id) + " is invalid.");
+        }
+        if (section.id < num_section_ids) // Sections of later versions that we don't know are skipped.
+        {
+            sections[section.id] = section;
+        }
+        if (progress)
+        {
+            progress->sections_decoded += 1;
+        }
+    }
+    const auto get_section = [&sections](SectionId id) -> const Section& {
+        return sections[static_cast<std::uint32_t>(id)];
+    };
+    const auto get_data = [&file, &get_section](SectionId id) -> const void* {
+        const auto& section = get_section(id);
+        return section.offset == 0 ? nullptr : file->data() + section.offset;
+    };
+    // Returns the precision of a basis, and its column scales, if it is stored as Int8:
+    const auto read_basis_scales = [&](SectionId basis_id, SectionId scales_id, const std::string& name,
+                                       BasisPrecision& precision) -> const float* {
+        const auto& basis = get_section(basis_id);
+        precision = to_basis_precision(static_cast<ElementType>(basis.element_type));
+        if (precision != BasisPrecision::Int8)
+        {
+            return nullptr;
+        }
+        const auto& scales = get_section(scales_id);
+        if (scales.offset == 0 || scales.rows != basis.cols || scales.cols != 1)
+        {
+            fail("The column scales of the " + name + " basis are missing or invalid.");
+        }
+        return static_cast<const float*>(get_data(scales_id));
+    };
+    const auto read_pca_model = [&](SectionId mean_id, SectionId basis_id, SectionId eigenvalues_id,
+                                    SectionId scales_id, const std::string& name) {
+        PcaModelView pca_model;
+        const auto& mean = get_section(mean_id);
+        const auto& basis = get_section(basis_id);
+        const auto& eigenvalues = get_section(eigenvalues_id);
+        if (mean.offset == 0)
+        {
+            return pca_model;
+        }
+        const bool basis_is_consistent = basis.offset == 0 ||
+                                         (basis.rows == mean.rows && eigenvalues.offset != 0 &&
+                                          eigenvalues.rows == basis.cols && eigenvalues.cols == 1);
+        if (mean.cols != 1 || !basis_is_consistent)
+        {
+            fail("The " + name + " model is inconsistent.");
+        }
+        pca_model.mean = static_cast<const float*>(get_data(mean_id));
+        pca_model.data_dimension = static_cast<int>(mean.rows);
+        if (basis.offset != 0)
+        {
+            pca_model.rescaled_pca_basis = get_data(basis_id);
+            pca_model.basis_column_scales =
+                read_basis_scales(basis_id, scales_id, name, pca_model.basis_precision);
+            pca_model.eigenvalues = static_cast<const float*>(get_data(eigenvalues_id));
+            pca_model.num_principal_components = static_cast<int>(basis.cols);
+        }
+        return pca_model;
+    };
+
+    LoadedModel model;
+    ModelView& view = model.view;
+    view.shape_model = read_pca_model(SectionId::ShapeMean, SectionId::ShapeBasis,
+                                      SectionId::ShapeEigenvalues, SectionId::ShapeBasisScales, "shape");
+    const auto dimension = view.shape_model.get_data_dimension();
+    if (dimension == 0 || dimension % 3 != 0)
+    {
+        fail("The shape model is missing or invalid.");
+    }
+    view.color_model = read_pca_model(SectionId::ColorMean, SectionId::ColorBasis,
+                                      SectionId::ColorEigenvalues, SectionId::ColorBasisScales, "colour");
+    if (view.color_model.get_data_dimension() != 0 && view.color_model.get_data_dimension() != dimension)
+    {
+        fail("The colour model doesn't match the shape model.");
+    }
+    if (get_data(SectionId::ExpressionMean))
+    {
+        view.expression_model_type = ExpressionModelType::PcaModel;
+        view.expression_pca_model =
+            read_pca_model(SectionId::ExpressionMean, SectionId::ExpressionBasis,
+                           SectionId::ExpressionEigenvalues, SectionId::ExpressionBasisScales, "expression");
+        if (view.expression_pca_model.get_data_dimension() != dimension)
+        {
+            fail("The expression model doesn't match the shape model.");
+        }
+    } else if (get_data(SectionId::Blendshapes))
+    {
+        if (get_section(SectionId::Blendshapes).rows != static_cast<std::uint64_t>(dimension))
+        {
+            fail("The blendshapes don't match the shape model.");
+        }
+        view.expression_model_type = ExpressionModelType::Blendshapes;
+        view.blendshapes = get_data(SectionId::Blendshapes);
+        view.blendshapes_column_scales =
+            read_basis_scales(SectionId::Blendshapes, SectionId::BlendshapesScales, "blendshapes",
+                              view.blendshapes_precision);
+        view.num_blendshapes = static_cast<int>(get_section(SectionId::Blendshapes).cols);
+    }
+    if (get_data(SectionId::Triangles))
+    {
+        if (get_section(SectionId::Triangles).cols != 3)
+        {
+            fail("The triangle list is invalid.");
+        }
+        view.triangles = static_cast<const int*>(get_data(SectionId::Triangles));
+        view.num_triangles = static_cast<int>(get_section(SectionId::Triangles).rows);
+    }
+    if (get_data(SectionId::TextureCoordinates))
+    {
+        const auto& texture_coordinates = get_section(SectionId::TextureCoordinates);
+        if (texture_coordinates.cols != 2 ||
+            texture_coordinates.rows != static_cast<std::uint64_t>(dimension / 3))
+        {
+            fail("The texture coordinates don't match the shape model.");
+        }
+        view.texture_coordinates = static_cast<const float*>(get_data(SectionId::TextureCoordinates));
+        view.num_texture_coordinates = static_cast<int>(texture_coordinates.rows);
+    }
+    if (get_data(SectionId::LandmarkVertices) || get_data(SectionId::LandmarkNames))
+    {
+        const auto& vertices = get_section(SectionId::LandmarkVertices);
+        const auto& names = get_section(SectionId::LandmarkNames);
+        if (vertices.offset == 0 || names.offset == 0 || vertices.cols != 1 || names.cols != 1)
+        {
+            fail("The landmark definitions are incomplete.");
+        }
+        view.landmark_vertices = static_cast<const int*>(get_data(SectionId::LandmarkVertices));
+        view.landmark_names = static_cast<const char*>(get_data(SectionId::LandmarkNames));
+        view.num_landmarks = static_cast<int>(vertices.rows);
+        view.landmark_names_size = static_cast<int>(names.rows);
+    }
+
+    // Read the first components of the bases, and everything else that's needed to display the model.
+    // The rest of the bases is read in the background:
+    std::vector<detail::ByteRange> resident_ranges;
+    std::vector<detail::ByteRange> background_ranges;
+    const auto add_section = [&](SectionId id) {
+        const auto& section = get_section(id);
+        if (section.offset != 0)
+        {
+            resident_ranges.push_back(
+                {section.offset, section.rows * section.cols * get_element_size(section)});
+        }
+    };
+    const auto add_basis = [&](SectionId id) {
+        const auto& section = get_section(id);
+        if (section.offset == 0)
+        {
+            return;
+        }
+        const auto column_size = section.rows * get_element_size(section);
+        const auto num_resident_columns =
+            num_resident_components < 0
+                ? section.cols
+                : std::min(section.cols, static_cast<std::uint64_t>(num_resident_components));
+        resident_ranges.push_back({section.offset, num_resident_columns * column_size});
+        if (num_resident_columns < section.cols)
+        {
+            background_ranges.push_back({section.offset + num_resident_columns * column_size,
+                                         (section.cols - num_resident_columns) * column_size});
+        }
+    };
+    add_section(SectionId::ShapeMean);
+    add_section(SectionId::ShapeEigenvalues);
+    add_section(SectionId::ShapeBasisScales);
+    add_basis(SectionId::ShapeBasis);
+    add_section(SectionId::ColorMean);
+    add_section(SectionId::ColorEigenvalues);
+    add_section(SectionId::ColorBasisScales);
+    add_basis(SectionId::ColorBasis);
+    if (view.expression_model_type == ExpressionModelType::PcaModel)
+    {
+        add_section(SectionId::ExpressionMean);
+        add_section(SectionId::ExpressionEigenvalues);
+        add_section(SectionId::ExpressionBasisScales);
+        add_basis(SectionId::ExpressionBasis);
+    } else if (view.expression_model_type == ExpressionModelType::Blendshapes)
+    {
+        add_section(SectionId::BlendshapesScales);
+        add_basis(SectionId::Blendshapes);
+    }
+    add_section(SectionId::TextureCoordinates);
+    add_section(SectionId::Triangles);
+    add_section(SectionId::LandmarkVertices);
+    add_section(SectionId::LandmarkNames);
+
+    if (progress)
+    {
+        for (const auto& range : resident_ranges)
+        {
+            progress->bytes_total += range.length;
+        }
+    }
+    // Let the OS read all of it at once, and then wait for it chunk by chunk. The chunks of all sections
+    // are read in parallel:
+    const auto read_start = trace::clock::now();
+    std::vector<detail::ByteRange> resident_chunks;
+    for (const auto& range : resident_ranges)
+    {
+        file->prefetch(range.offset, range.length);
+        for (std::uint64_t done = 0; done < range.length; done += detail::fault_in_chunk_size)
+        {
+            resident_chunks.push_back(
+                {range.offset + done, std::min(detail::fault_in_chunk_size, range.length - done)});
+        }
+    }
+    parallel_for(thread_pool, static_cast<std::ptrdiff_t>(resident_chunks.size()), [&](std::ptrdiff_t i) {
+        file->fault_in(resident_chunks[i].offset, resident_chunks[i].length);
+        if (progress)
+        {
+            progress->bytes_read += resident_chunks[i].length;
+        }
+    });
+
+    trace::add_span("read resident sections", read_start, trace::clock::now());
+
+    // Check the vertex indices of the triangles, in blocks of triangles in parallel:
+    trace::Span validation_span("validate indices");
+    const auto triangles = view.get_triangles();
+    const Eigen::Index triangles_per_block = 64 * 1024;
+    std::atomic<bool> triangles_are_valid{true};
+    const auto num_blocks = (triangles.rows() + triangles_per_block - 1) / triangles_per_block;
+    parallel_for(thread_pool, num_blocks, [&](std::ptrdiff_t i) {
+        const auto first_triangle = i * triangles_per_block;
+        const auto block = triangles.middleRows(
+            first_triangle, std::min(triangles_per_block, triangles.rows() - first_triangle));
+        if (block.minCoeff() < 0 || block.maxCoeff() >= dimension / 3)
+        {
+            triangles_are_valid = false;
+        }
+    });
+    if (!triangles_are_valid)
+    {
+        fail("The triangle list contains invalid vertex indices.");
+    }
+    // Each landmark has to have a vertex of the model, and a name:
+    const Eigen::Map<const Eigen::VectorXi> landmark_vertices(view.landmark_vertices, view.num_landmarks);
+    const auto num_names =
+        std::count(view.landmark_names, view.landmark_names + view.landmark_names_size, '\0');
+    if ((view.num_landmarks > 0 &&
+         (landmark_vertices.minCoeff() < 0 || landmark_vertices.maxCoeff() >= dimension / 3)) ||
+        num_names != view.num_landmarks ||
+        (view.landmark_names_size > 0 && view.landmark_names[view.landmark_names_size - 1] != '\0'))
+    {
+        fail("The landmark definitions are invalid.");
+    }
+    if (!background_ranges.empty())
+    {
+        storage->fault_in_background(std::move(background_ranges));
+    }
+    model.storage = std::move(storage);
+    return model;
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_MODEL_CONTAINER_HPP */
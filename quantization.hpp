@@ -0,0 +1,387 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: quantization.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_QUANTIZATION_HPP
+#define EOSVIEWER_QUANTIZATION_HPP
+
+#include "BasisView.hpp"
+#include "half_float.hpp"
+#include "LoadedModel.hpp"
+#include "ModelEvaluator.hpp"
+#include "ModelView.hpp"
+#include "random_sample.hpp"
+#include "ThreadPool.hpp"
+#include "tiled_kernels.hpp"
+#include "trace.hpp"
+
+#include "Eigen/Core"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <vector>
+
+namespace eosviewer {
+
+namespace detail {
+
+/**
+ * A basis in a BasisPrecision, together with its column scales.
+ */
+struct QuantizedBasis
+{
+    std::vector<unsigned char> data;
+    std::vector<float> column_scales;
+    BasisPrecision precision = BasisPrecision::Float32;
+    int rows = 0;
+    int cols = 0;
+
+    BasisView get_view() const
+    {
+        BasisView view;
+        view.data = data.empty() ? nullptr : data.data();
+        view.column_scales = column_scales.empty() ? nullptr : column_scales.data();
+        view.precision = precision;
+        view.rows = rows;
+        view.cols = cols;
+        return view;
+    };
+};
+
+/**
+ * The storage of a model whose bases have been quantized with quantize_model(). It holds copies of all
+ * the arrays, so it doesn't depend on the model it has been created from.
+ */
+struct QuantizedModelStorage
+{
+    struct PcaModel
+    {
+        std::vector<float> mean;
+        std::vector<float> eigenvalues;
+        QuantizedBasis basis;
+    };
+    PcaModel shape_model;
+    PcaModel color_model;
+    PcaModel expression_pca_model;
+    QuantizedBasis blendshapes;
+    std::vector<int> triangles;
+    std::vector<float> texture_coordinates;
+    PackedLandmarks landmarks;
+};
+
+} /* namespace detail */
+
+/**
+ * Converts a basis to the given precision.
+ *
+ * fp16 rounds each element to the nearest half-precision value. int8 scales each column by its
+ * largest absolute value, so that it maps to 127, and rounds to the nearest integer. A column of
+ * zeros gets a scale of 0. The source basis can be in any precision; it is dequantized first.
+ *
+ * @param[in] basis The basis to convert.
+ * @param[in] precision The precision to convert it to.
+ * @return The converted basis.
+ */
+inline detail::QuantizedBasis quantize(const BasisView& basis, BasisPrecision precision)
+{
+    detail::QuantizedBasis result;
+    result.precision = precision;
+    result.rows = basis.rows;
+    result.cols = basis.cols;
+    result.data.resize(static_cast<std::size_t>(basis.rows) * basis.cols * get_element_size(precision));
+    if (precision == BasisPrecision::Int8)
+    {
+        result.column_scales.resize(basis.cols);
+    }
+    const auto column_size = static_cast<std::size_t>(basis.rows) * get_element_size(precision);
+    std::vector<float> column(basis.rows);
+    for (int col = 0; col < basis.cols; ++col)
+    {
+        // Adding a column to zeros gives exactly the dequantized column:
+        std::fill(begin(column), end(column), 0.0f);
+        kernels::axpy(nullptr, 1.0f, basis, col, column.data());
+        void* destination = result.data.data() + col * column_size;
+        if (precision == BasisPrecision::Float32)
+        {
+            std::copy(begin(column), end(column), static_cast<float*>(destination));
+        } else if (precision == BasisPrecision::Float16)
+        {
+            std::transform(begin(column), end(column), static_cast<std::uint16_t*>(destination),
+                           [](float value) { return float_to_half(value); });
+        } else
+        {
+            float max_abs = 0.0f;
+            for (const auto value : column)
+            {
+                max_abs = std::max(max_abs, std::abs(value));
+            }
+            const float scale = max_abs / 127.0f;
+            result.column_scales[col] = scale;
+            std::transform(begin(column), end(column), static_cast<std::int8_t*>(destination),
+                           [scale](float value) {
+                               if (scale == 0.0f)
+                               {
+                                   return std::int8_t(0);
+                               }
+                               const auto q = std::lround(value / scale);
+                               return static_cast<std::int8_t>(std::max(-127L, std::min(127L, q)));
+                           });
+        }
+    }
+    return result;
+};
+
+/**
+ * Returns a copy of the given model with the shape, colour and expression bases (or the blendshapes)
+ * converted to the given precision, see quantize(). The means, eigenvalues, triangles, texture
+ * coordinates and landmark definitions are copied as they are. The result has its own storage, so the
+ * given model can be released afterwards.
+ *
+ * The evaluation functions dequantize the bases on the fly, so an fp16 model needs half and an int8
+ * model about a quarter of the memory and memory bandwidth of the float model.
+ *
+ * @param[in] model The model to convert.
+ * @param[in] precision The precision of the bases of the result.
+ * @return The converted model.
+ */
+inline LoadedModel quantize_model(const ModelView& model, BasisPrecision precision)
+{
+    trace::Span span("quantize model");
+    auto storage = std::make_shared<detail::QuantizedModelStorage>();
+    const auto quantize_pca_model = [precision](const PcaModelView& pca_model,
+                                                detail::QuantizedModelStorage::PcaModel& pca_storage) {
+        PcaModelView result = pca_model;
+        if (!pca_model.mean)
+        {
+            return result;
+        }
+        const auto mean = pca_model.get_mean();
+        pca_storage.mean.assign(mean.data(), mean.data() + mean.size());
+        result.mean = pca_storage.mean.data();
+        if (pca_model.rescaled_pca_basis)
+        {
+            const auto eigenvalues = pca_model.get_eigenvalues();
+            pca_storage.eigenvalues.assign(eigenvalues.data(), eigenvalues.data() + eigenvalues.size());
+            pca_storage.basis = quantize(pca_model.get_rescaled_pca_basis(), precision);
+            const auto basis = pca_storage.basis.get_view();
+            result.eigenvalues = pca_storage.eigenvalues.data();
+            result.rescaled_pca_basis = basis.data;
+            result.basis_column_scales = basis.column_scales;
+            result.basis_precision = precision;
+        }
+        return result;
+    };
+
+    LoadedModel result;
+    auto& view = result.view;
+    view = model;
+    view.sparse_blendshapes = SparseBasisView(); // points into the storage of the given model
+    view.shape_model = quantize_pca_model(model.shape_model, storage->shape_model);
+    view.color_model = quantize_pca_model(model.color_model, storage->color_model);
+    if (model.expression_model_type == ExpressionModelType::PcaModel)
+    {
+        view.expression_pca_model =
+            quantize_pca_model(model.expression_pca_model, storage->expression_pca_model);
+    } else if (model.expression_model_type == ExpressionModelType::Blendshapes)
+    {
+        storage->blendshapes = quantize(model.get_expression_basis(), precision);
+        const auto blendshapes = storage->blendshapes.get_view();
+        view.blendshapes = blendshapes.data;
+        view.blendshapes_column_scales = blendshapes.column_scales;
+        view.blendshapes_precision = precision;
+    }
+    if (model.triangles)
+    {
+        storage->triangles.assign(model.triangles, model.triangles + 3 * model.num_triangles);
+        view.triangles = storage->triangles.data();
+    }
+    if (model.texture_coordinates)
+    {
+        storage->texture_coordinates.assign(model.texture_coordinates,
+                                            model.texture_coordinates + 2 * model.num_texture_coordinates);
+        view.texture_coordinates = storage->texture_coordinates.data();
+    }
+    storage->landmarks =
+        PackedLandmarks(model.get_landmark_definitions(), model.shape_model.get_data_dimension() / 3);
+    storage->landmarks.set_view(view);
+    result.storage = std::move(storage);
+    return result;
+};
+
+/**
+ * Returns the given model with its blendshapes converted to the given precision, see quantize(), and
+ * everything else shared with the given model, not copied. This is for blendshapes that have been
+ * attached (see with_blendshapes()) to a model that has already been converted with quantize_model().
+ *
+ * @param[in] model The model whose blendshapes to convert. Returned as it is if it has none.
+ * @param[in] precision The precision of the blendshapes of the result.
+ * @return The model with converted blendshapes.
+ */
+inline LoadedModel with_quantized_blendshapes(const LoadedModel& model, BasisPrecision precision)
+{
+    if (model.view.expression_model_type != ExpressionModelType::Blendshapes)
+    {
+        return model;
+    }
+    trace::Span span("quantize blendshapes");
+    auto blendshapes =
+        std::make_shared<detail::QuantizedBasis>(quantize(model.view.get_expression_basis(), precision));
+    const auto blendshapes_view = blendshapes->get_view();
+    LoadedModel result = model;
+    result.view.blendshapes = blendshapes_view.data;
+    result.view.blendshapes_column_scales = blendshapes_view.column_scales;
+    result.view.blendshapes_precision = precision;
+    // Sparse blendshapes would still be the unconverted ones:
+    result.view.sparse_blendshapes = SparseBasisView();
+    result.sparse_blendshapes_storage.reset();
+    result.blendshapes_storage = std::move(blendshapes);
+    return result;
+};
+
+/**
+ * The error of a quantized model in one part of the instances (shape or colour), as the Euclidean
+ * distance of each vertex (or vertex colour) to the one of the float32 model.
+ */
+struct QuantizationError
+{
+    double max_error = 0.0;
+    double mean_error = 0.0;
+};
+
+/**
+ * The result of compare_to_reference().
+ */
+struct QuantizationReport
+{
+    QuantizationError shape; // including the expression
+    QuantizationError color;
+    std::size_t basis_size = 0;  // of all the bases of the quantized model, in bytes
+    double seconds_per_sample = 0.0; // to evaluate the shape, expression and colour of a sample
+};
+
+/**
+ * Evaluates random samples with both the given model and a quantized version of it, and compares them
+ * per vertex. The coefficients are drawn like in the headless mode, with draw_random_coefficients().
+ *
+ * @param[in] reference The model to compare against, usually with float32 bases.
+ * @param[in] quantized The quantized model, see quantize_model().
+ * @param[in] num_samples The number of samples to compare.
+ * @param[in] sdev Standard deviations of the shape, expression and colour coefficients.
+ * @param[in] seed The seed of the random number generator.
+ * @param[in] thread_pool If given, the samples are evaluated in parallel on this pool.
+ * @return The errors, the size of the quantized bases and the evaluation time of the quantized model.
+ */
+inline QuantizationReport compare_to_reference(const ModelView& reference, const ModelView& quantized,
+                                               int num_samples, const std::array<float, 3>& sdev,
+                                               std::uint32_t seed, ThreadPool* thread_pool = nullptr)
+{
+    using clock = std::chrono::steady_clock;
+    using seconds = std::chrono::duration<double>;
+    std::default_random_engine rng(seed);
+    std::vector<float> shape_coefficients, expression_coefficients, color_coefficients;
+    Eigen::VectorXf reference_shape, reference_color, shape, color;
+    QuantizationReport report;
+    seconds evaluation_time{0.0};
+    std::size_t num_vertices = 0;
+    const auto evaluate = [&](const ModelView& model, Eigen::VectorXf& shape_instance,
+                              Eigen::VectorXf& color_instance) {
+        shape_instance.setZero(model.shape_model.get_data_dimension());
+        add_sample(model.shape_model, shape_coefficients, shape_instance, thread_pool);
+        add_expression_sample(model, expression_coefficients, shape_instance, thread_pool);
+        color_instance.setZero(model.color_model.get_data_dimension());
+        add_sample(model.color_model, color_coefficients, color_instance, thread_pool);
+    };
+    const auto accumulate = [](const Eigen::VectorXf& expected, const Eigen::VectorXf& actual,
+                               QuantizationError& error) {
+        for (Eigen::Index i = 0; i + 2 < expected.size(); i += 3)
+        {
+            const double distance = (expected.segment<3>(i) - actual.segment<3>(i)).norm();
+            error.max_error = std::max(error.max_error, distance);
+            error.mean_error += distance; // divided by the number of vertices at the end
+        }
+    };
+    for (int sample = 0; sample < num_samples; ++sample)
+    {
+        draw_random_coefficients(reference, sdev, rng, shape_coefficients, expression_coefficients,
+                                 color_coefficients);
+        evaluate(reference, reference_shape, reference_color);
+        const auto start = clock::now();
+        evaluate(quantized, shape, color);
+        evaluation_time += clock::now() - start;
+        accumulate(reference_shape, shape, report.shape);
+        accumulate(reference_color, color, report.color);
+        num_vertices += reference_shape.size() / 3;
+    }
+    if (num_vertices > 0)
+    {
+        report.shape.mean_error /= num_vertices;
+        report.color.mean_error /= num_vertices;
+        report.seconds_per_sample = evaluation_time.count() / num_samples;
+    }
+    report.basis_size = quantized.shape_model.get_rescaled_pca_basis().get_size_in_bytes() +
+                        quantized.color_model.get_rescaled_pca_basis().get_size_in_bytes();
+    if (quantized.expression_model_type == ExpressionModelType::PcaModel)
+    {
+        report.basis_size += quantized.expression_pca_model.get_rescaled_pca_basis().get_size_in_bytes();
+    } else if (quantized.expression_model_type == ExpressionModelType::Blendshapes)
+    {
+        report.basis_size += quantized.get_expression_basis().get_size_in_bytes();
+    }
+    return report;
+};
+
+/**
+ * Quantizes the given model to fp16 and to int8, and reports the size of the bases, the per-vertex
+ * errors against the given model (see compare_to_reference()) and the evaluation time of each.
+ *
+ * @param[in] model The float32 model.
+ * @param[in] num_samples The number of random samples to compare.
+ * @param[in] sdev Standard deviations of the shape, expression and colour coefficients.
+ * @param[in] seed The seed of the random number generator.
+ * @param[in] log The stream to write the report to.
+ */
+inline void report_quantization_error(const ModelView& model, int num_samples,
+                                      const std::array<float, 3>& sdev, std::uint32_t seed, std::ostream& log)
+{
+    ThreadPool thread_pool;
+    const auto mib = [](std::size_t bytes) { return bytes / (1024.0 * 1024.0); };
+    log << "Per-vertex error of the quantized bases, over " << num_samples << " random samples:" << std::endl;
+    for (const auto precision : {BasisPrecision::Float32, BasisPrecision::Float16, BasisPrecision::Int8})
+    {
+        const auto quantized = quantize_model(model, precision);
+        const auto report =
+            compare_to_reference(model, quantized.view, num_samples, sdev, seed, &thread_pool);
+        log << "  " << to_string(precision) << ": bases " << mib(report.basis_size)
+            << " MiB, shape error max " << report.shape.max_error << " mean " << report.shape.mean_error
+            << ", colour error max " << report.color.max_error << " mean " << report.color.mean_error << ", "
+            << report.seconds_per_sample * 1000.0 << " ms per sample." << std::endl;
+    }
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_QUANTIZATION_HPP */
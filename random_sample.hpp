@@ -0,0 +1,86 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: random_sample.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_RANDOM_SAMPLE_HPP
+#define EOSVIEWER_RANDOM_SAMPLE_HPP
+
+#include "ModelView.hpp"
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * Draws random coefficients for a face sample.
+ *
+ * The shape and colour coefficients, and the expression coefficients of a PCA expression model,
+ * are drawn from a normal distribution with the given standard deviation. Blendshape coefficients
+ * are drawn uniformly from the interval [0, sdev] (so it's not really an sdev there), since
+ * negative blendshape coefficients don't give plausible expressions. If the model has no separate
+ * expression model, the expression coefficients are cleared.
+ *
+ * This is the sampling that the viewer's "Random face sample" button uses, and the headless mode.
+ *
+ * @param[in] morphable_model The model to draw a sample of.
+ * @param[in] sdev Standard deviations for the shape, expression and colour coefficients.
+ * @param[in,out] rng The random number generator to use.
+ * @param[out] shape_coefficients The shape coefficients, one per principal component.
+ * @param[out] expression_coefficients The expression coefficients, one per component/blendshape.
+ * @param[out] color_coefficients The colour coefficients, one per principal component.
+ */
+template <class RandomNumberGenerator>
+void draw_random_coefficients(const ModelView& morphable_model,
+                              const std::array<float, 3>& sdev, RandomNumberGenerator& rng,
+                              std::vector<float>& shape_coefficients,
+                              std::vector<float>& expression_coefficients,
+                              std::vector<float>& color_coefficients)
+{
+    // Shape sample:
+    std::normal_distribution<float> shape_coeffs_dist(0.0f, sdev[0]); // c'tor takes stddev
+    shape_coefficients.resize(morphable_model.get_shape_model().get_num_principal_components());
+    std::generate(begin(shape_coefficients), end(shape_coefficients),
+                  [&rng, &shape_coeffs_dist]() { return shape_coeffs_dist(rng); });
+    // Expression sample:
+    expression_coefficients.resize(morphable_model.get_num_expression_coefficients());
+    if (morphable_model.expression_model_type == ExpressionModelType::Blendshapes)
+    {
+        std::uniform_real_distribution<float> expression_coeffs_dist(0.0f, sdev[1]);
+        std::generate(begin(expression_coefficients), end(expression_coefficients),
+                      [&rng, &expression_coeffs_dist]() { return expression_coeffs_dist(rng); });
+    } else if (morphable_model.expression_model_type == ExpressionModelType::PcaModel)
+    {
+        std::normal_distribution<float> expression_coeffs_dist(0.0f, sdev[1]);
+        std::generate(begin(expression_coefficients), end(expression_coefficients),
+                      [&rng, &expression_coeffs_dist]() { return expression_coeffs_dist(rng); });
+    }
+    // Colour sample:
+    std::normal_distribution<float> color_coeffs_dist(0.0f, sdev[2]);
+    color_coefficients.resize(morphable_model.get_color_model().get_num_principal_components());
+    std::generate(begin(color_coefficients), end(color_coefficients),
+                  [&rng, &color_coeffs_dist]() { return color_coeffs_dist(rng); });
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_RANDOM_SAMPLE_HPP */
@@ -0,0 +1,369 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: tiled_kernels.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_TILED_KERNELS_HPP
+#define EOSVIEWER_TILED_KERNELS_HPP
+
+#include "BasisView.hpp"
+#include "kernels.hpp"
+#include "ThreadPool.hpp"
+
+#include "Eigen/Core"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace eosviewer {
+namespace kernels {
+
+/**
+ * Returns the size of the L2 cache in bytes, or 256 KiB if it can't be determined.
+ */
+inline std::size_t get_l2_cache_size()
+{
+#if defined(__linux__) && defined(_SC_LEVEL2_CACHE_SIZE)
+    const long l2_cache_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2_cache_size > 0)
+    {
+        return static_cast<std::size_t>(l2_cache_size);
+    }
+#endif
+    return 256 * 1024;
+};
+
+/**
+ * Returns the number of rows (i.e. 3 * vertices) of a tile, in which the evaluation is split up.
+ *
+ * A tile is sized so that while it is being computed, its part of the output and the parts of the
+ * four basis columns that the kernels process at a time take up half of the L2 cache. It is a multiple
+ * of 48 rows, so that tiles never split a vertex, and start at a multiple of the AVX-512 register width.
+ */
+inline std::ptrdiff_t get_tile_rows()
+{
+    static const std::ptrdiff_t tile_rows = [] {
+        const auto rows = static_cast<std::ptrdiff_t>(get_l2_cache_size() / 2 / (5 * sizeof(float)));
+        return std::max<std::ptrdiff_t>(48, rows - rows % 48);
+    }();
+    return tile_rows;
+};
+
+/**
+ * Splits the rows [0, rows) into tiles of tile_rows rows (the last one may be smaller), and calls
+ * tile(first_row, num_rows) for each of them, on the given thread pool.
+ *
+ * @param[in] thread_pool The pool to run the tiles on. If nullptr, they are run on the calling thread.
+ */
+template <class Tile>
+void run_tiles(ThreadPool* thread_pool, std::ptrdiff_t rows, std::ptrdiff_t tile_rows, Tile&& tile)
+{
+    const auto num_tiles = (rows + tile_rows - 1) / tile_rows;
+    parallel_for(thread_pool, num_tiles, [&](std::ptrdiff_t tile_index) {
+        const auto first_row = tile_index * tile_rows;
+        tile(first_row, std::min(tile_rows, rows - first_row));
+    });
+};
+
+/**
+ * Computes y += A * x like GemvAddFunction, split into tiles of rows that are processed on the
+ * given thread pool.
+ *
+ * The tiles don't depend on the number of threads, and the kernels compute each row with the same
+ * sequence of operations, no matter which tile it is in. So the result is bit-identical to the
+ * single-threaded result.
+ *
+ * @param[in] thread_pool The pool to run the tiles on. If nullptr, they are run on the calling thread.
+ */
+inline void gemv_add(ThreadPool* thread_pool, const float* A, std::ptrdiff_t rows, std::ptrdiff_t cols,
+                     std::ptrdiff_t lda, const float* x, float* y)
+{
+    const auto gemv_add_kernel = get_kernels().gemv_add;
+    const auto tile_rows = get_tile_rows();
+    const auto tile = [&](std::ptrdiff_t first_row, std::ptrdiff_t num_rows) {
+        gemv_add_kernel(A + first_row, num_rows, cols, lda, x, y + first_row);
+    };
+    run_tiles(thread_pool, rows, tile_rows, tile);
+};
+
+/**
+ * Computes y += a * x like AxpyFunction, split into tiles that are processed on the given thread pool.
+ *
+ * @param[in] thread_pool The pool to run the tiles on. If nullptr, they are run on the calling thread.
+ */
+inline void axpy(ThreadPool* thread_pool, float a, const float* x, std::ptrdiff_t n, float* y)
+{
+    const auto axpy_kernel = get_kernels().axpy;
+    // An axpy reads only one column, so the tiles can be larger than for gemv_add:
+    const auto tile_rows = 4 * get_tile_rows();
+    const auto tile = [&](std::ptrdiff_t first_row, std::ptrdiff_t num_rows) {
+        axpy_kernel(a, x + first_row, num_rows, y + first_row);
+    };
+    run_tiles(thread_pool, n, tile_rows, tile);
+};
+
+/**
+ * Computes Y += A * X for a batch of vectors, i.e. a matrix-matrix product, split into tiles of rows
+ * that are processed on the given thread pool. All matrices are column-major.
+ *
+ * Each tile is a blocked, vectorised GEMM (Eigen's), which loads every element of A once per batch,
+ * instead of once per vector as a sequence of gemv_add() calls would. The result is the same as that
+ * of gemv_add() up to the order of the floating point operations.
+ *
+ * @param[in] thread_pool The pool to run the tiles on. If nullptr, they are run on the calling thread.
+ * @param[in] A The rows x cols matrix, with leading dimension lda.
+ * @param[in] X The cols x batch_size matrix, with leading dimension ldx.
+ * @param[in,out] Y The rows x batch_size matrix to add the product to, with leading dimension ldy.
+ */
+inline void gemm_add(ThreadPool* thread_pool, const float* A, std::ptrdiff_t rows, std::ptrdiff_t cols,
+                     std::ptrdiff_t lda, const float* X, std::ptrdiff_t ldx, std::ptrdiff_t batch_size,
+                     float* Y, std::ptrdiff_t ldy)
+{
+    using Eigen::OuterStride;
+    using ConstMatrixMap = Eigen::Map<const Eigen::MatrixXf, Eigen::Unaligned, OuterStride<>>;
+    using MatrixMap = Eigen::Map<Eigen::MatrixXf, Eigen::Unaligned, OuterStride<>>;
+    if (rows == 0 || cols == 0 || batch_size == 0)
+    {
+        return;
+    }
+    const ConstMatrixMap x(X, cols, batch_size, OuterStride<>(ldx));
+    const auto tile_rows = get_tile_rows();
+    const auto tile = [&](std::ptrdiff_t first_row, std::ptrdiff_t num_rows) {
+        MatrixMap y(Y + first_row, num_rows, batch_size, OuterStride<>(ldy));
+        y.noalias() += ConstMatrixMap(A + first_row, num_rows, cols, OuterStride<>(lda)) * x;
+    };
+    run_tiles(thread_pool, rows, tile_rows, tile);
+};
+
+/**
+ * Computes y += A * x for a basis in any precision, with the first cols columns of A, split into
+ * tiles like gemv_add(). fp16 and int8 bases are dequantized by the kernels as they're loaded.
+ *
+ * @param[in] thread_pool The pool to run the tiles on. If nullptr, they are run on the calling thread.
+ * @param[in] A The basis.
+ * @param[in] cols The number of columns of A to use, and the length of x.
+ * @param[in] x The vector to multiply with.
+ * @param[in,out] y The vector of length A.rows to add the product to.
+ */
+inline void gemv_add(ThreadPool* thread_pool, const BasisView& A, std::ptrdiff_t cols, const float* x,
+                     float* y)
+{
+    if (A.precision == BasisPrecision::Float32)
+    {
+        gemv_add(thread_pool, static_cast<const float*>(A.data), A.rows, cols, A.rows, x, y);
+        return;
+    }
+    const auto& kernels = get_kernels();
+    const std::ptrdiff_t rows = A.rows;
+    const auto tile_rows = get_tile_rows();
+    const auto tile = [&](std::ptrdiff_t first_row, std::ptrdiff_t num_rows) {
+        if (A.precision == BasisPrecision::Float16)
+        {
+            kernels.gemv_add_f16(static_cast<const std::uint16_t*>(A.data) + first_row, num_rows, cols, rows,
+                                 x, y + first_row);
+        } else
+        {
+            kernels.gemv_add_i8(static_cast<const std::int8_t*>(A.data) + first_row, num_rows, cols, rows,
+                                A.column_scales, x, y + first_row);
+        }
+    };
+    run_tiles(thread_pool, rows, tile_rows, tile);
+};
+
+/**
+ * Computes y += a * A.col(col) for a basis in any precision, split into tiles like axpy().
+ *
+ * @param[in] thread_pool The pool to run the tiles on. If nullptr, they are run on the calling thread.
+ */
+inline void axpy(ThreadPool* thread_pool, float a, const BasisView& A, int col, float* y)
+{
+    if (A.precision == BasisPrecision::Float32)
+    {
+        axpy(thread_pool, a, static_cast<const float*>(A.get_column(col)), A.rows, y);
+        return;
+    }
+    const auto& kernels = get_kernels();
+    const std::ptrdiff_t n = A.rows;
+    const auto tile_rows = 4 * get_tile_rows();
+    const auto tile = [&](std::ptrdiff_t first_row, std::ptrdiff_t num_rows) {
+        if (A.precision == BasisPrecision::Float16)
+        {
+            kernels.axpy_f16(a, static_cast<const std::uint16_t*>(A.get_column(col)) + first_row, num_rows,
+                             y + first_row);
+        } else
+        {
+            kernels.axpy_i8(a * A.column_scales[col],
+                            static_cast<const std::int8_t*>(A.get_column(col)) + first_row, num_rows,
+                            y + first_row);
+        }
+    };
+    run_tiles(thread_pool, n, tile_rows, tile);
+};
+
+/**
+ * Computes Y += A * X like gemm_add(), for a basis in any precision, with the first cols columns of A.
+ *
+ * An fp16 or int8 basis is dequantized one tile at a time, into a buffer that is allocated per tile,
+ * and then multiplied like a float basis. This is meant for batches (see batch_evaluation.hpp), for
+ * which the dequantization is shared by all the vectors of the batch.
+ */
+inline void gemm_add(ThreadPool* thread_pool, const BasisView& A, std::ptrdiff_t cols, const float* X,
+                     std::ptrdiff_t ldx, std::ptrdiff_t batch_size, float* Y, std::ptrdiff_t ldy)
+{
+    if (A.precision == BasisPrecision::Float32)
+    {
+        gemm_add(thread_pool, static_cast<const float*>(A.data), A.rows, cols, A.rows, X, ldx, batch_size, Y,
+                 ldy);
+        return;
+    }
+    const auto& kernels = get_kernels();
+    const auto tile_rows = get_tile_rows();
+    const std::ptrdiff_t rows = A.rows;
+    const auto tile = [&](std::ptrdiff_t first_row, std::ptrdiff_t num_rows) {
+        // Adding a times a column to zeros gives exactly the dequantized column:
+        Eigen::MatrixXf dequantized = Eigen::MatrixXf::Zero(num_rows, cols);
+        for (int k = 0; k < cols; ++k)
+        {
+            if (A.precision == BasisPrecision::Float16)
+            {
+                kernels.axpy_f16(1.0f, static_cast<const std::uint16_t*>(A.get_column(k)) + first_row,
+                                 num_rows, dequantized.col(k).data());
+            } else
+            {
+                kernels.axpy_i8(A.column_scales[k],
+                                static_cast<const std::int8_t*>(A.get_column(k)) + first_row, num_rows,
+                                dequantized.col(k).data());
+            }
+        }
+        gemm_add(nullptr, dequantized.data(), num_rows, cols, num_rows, X, ldx, batch_size, Y + first_row,
+                 ldy);
+    };
+    run_tiles(thread_pool, rows, tile_rows, tile);
+};
+
+namespace detail {
+
+/**
+ * Calls f(first_row, num_rows, values) for the part of each block of the given column of a sparse
+ * basis that lies within [first_row, end_row).
+ */
+template <class Function>
+void for_each_block(const SparseBasisView& A, int col, std::ptrdiff_t first_row, std::ptrdiff_t end_row,
+                    Function&& f)
+{
+    const auto begin_block = A.blocks + A.column_blocks[col];
+    const auto end_block = A.blocks + A.column_blocks[col + 1];
+    // The first block that ends after first_row:
+    auto block = std::upper_bound(begin_block, end_block, first_row,
+                                  [](std::ptrdiff_t row, const RowBlock& block) {
+                                      return row < block.first_row + block.num_rows;
+                                  });
+    for (; block != end_block && block->first_row < end_row; ++block)
+    {
+        const auto first = std::max<std::ptrdiff_t>(block->first_row, first_row);
+        const auto end = std::min<std::ptrdiff_t>(block->first_row + block->num_rows, end_row);
+        f(first, end - first, A.values + block->value_offset + (first - block->first_row));
+    }
+};
+
+} /* namespace detail */
+
+/**
+ * Computes y += A * x for a sparse basis, with the first cols columns of A, split into tiles of rows
+ * like gemv_add(). Only the stored blocks are read, and columns whose coefficient is zero are skipped.
+ * As the tiles don't depend on the number of threads, the result is bit-identical to the
+ * single-threaded one.
+ *
+ * @param[in] thread_pool The pool to run the tiles on. If nullptr, they are run on the calling thread.
+ * @param[in] A The sparse basis.
+ * @param[in] cols The number of columns of A to use, and the length of x.
+ * @param[in] x The vector to multiply with.
+ * @param[in,out] y The vector of length A.rows to add the product to.
+ */
+inline void gemv_add(ThreadPool* thread_pool, const SparseBasisView& A, std::ptrdiff_t cols, const float* x,
+                     float* y)
+{
+    const auto axpy_kernel = get_kernels().axpy;
+    const std::ptrdiff_t rows = A.rows;
+    const auto tile_rows = 4 * get_tile_rows();
+    const auto tile = [&](std::ptrdiff_t first_row, std::ptrdiff_t num_rows) {
+        const auto end_row = first_row + num_rows;
+        for (int k = 0; k < cols; ++k)
+        {
+            if (x[k] == 0.0f)
+            {
+                continue;
+            }
+            detail::for_each_block(A, k, first_row, end_row,
+                                   [&](std::ptrdiff_t row, std::ptrdiff_t num_rows, const float* values) {
+                                       axpy_kernel(x[k], values, num_rows, y + row);
+                                   });
+        }
+    };
+    run_tiles(thread_pool, rows, tile_rows, tile);
+};
+
+/**
+ * Computes y += a * A.col(col) for a sparse basis. This only touches the stored rows of the column,
+ * which are usually few, so it runs on the calling thread.
+ */
+inline void axpy(float a, const SparseBasisView& A, int col, float* y)
+{
+    const auto axpy_kernel = get_kernels().axpy;
+    detail::for_each_block(A, col, 0, A.rows,
+                           [&](std::ptrdiff_t row, std::ptrdiff_t num_rows, const float* values) {
+                               axpy_kernel(a, values, num_rows, y + row);
+                           });
+};
+
+/**
+ * Computes Y += A * X like gemm_add(), for a sparse basis, with the first cols columns of A. Each stored
+ * block is added to all the vectors of the batch while it is in cache.
+ */
+inline void gemm_add(ThreadPool* thread_pool, const SparseBasisView& A, std::ptrdiff_t cols, const float* X,
+                     std::ptrdiff_t ldx, std::ptrdiff_t batch_size, float* Y, std::ptrdiff_t ldy)
+{
+    const auto axpy_kernel = get_kernels().axpy;
+    const std::ptrdiff_t rows = A.rows;
+    const auto tile_rows = 4 * get_tile_rows();
+    const auto tile = [&](std::ptrdiff_t first_row, std::ptrdiff_t num_rows) {
+        const auto end_row = first_row + num_rows;
+        for (int k = 0; k < cols; ++k)
+        {
+            detail::for_each_block(A, k, first_row, end_row,
+                                   [&](std::ptrdiff_t row, std::ptrdiff_t num_rows, const float* values) {
+                                       for (std::ptrdiff_t j = 0; j < batch_size; ++j)
+                                       {
+                                           axpy_kernel(X[k + j * ldx], values, num_rows, Y + row + j * ldy);
+                                       }
+                                   });
+        }
+    };
+    run_tiles(thread_pool, rows, tile_rows, tile);
+};
+
+} /* namespace kernels */
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_TILED_KERNELS_HPP */
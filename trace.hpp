@@ -0,0 +1,357 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: trace.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_TRACE_HPP
+#define EOSVIEWER_TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace eosviewer {
+
+/**
+ * Tracing: a timeline of spans (a name, and when it started and ended) from all threads, which can be
+ * written as Chrome trace JSON and viewed in chrome://tracing or Perfetto (https://ui.perfetto.dev).
+ *
+ * Tracing is off until enable() is called. While it's off, a span costs a relaxed atomic load. While
+ * it's on, each thread appends its spans to a buffer of its own, without locks: the mutex is only taken
+ * once per thread, when its buffer is created. The buffer grows in chunks and is never moved, so that
+ * write_chrome_trace() can read the spans while the threads keep recording.
+ *
+ * The names of spans are not copied, so they have to outlive the trace: they have to be string literals,
+ * or names that have been copied into the trace with intern().
+ */
+namespace trace {
+
+using clock = std::chrono::steady_clock;
+
+namespace detail {
+
+struct Event
+{
+    const char* name;
+    clock::time_point start;
+    clock::time_point end;
+};
+
+struct Chunk
+{
+    static const std::size_t capacity = 4096;
+    Event events[capacity];
+    std::atomic<std::size_t> num_events{0}; // only written by the owning thread
+    std::atomic<Chunk*> next{nullptr};
+};
+
+struct ThreadBuffer
+{
+    int thread_id = 0;
+    std::atomic<const char*> thread_name{nullptr};
+    std::unique_ptr<Chunk> first = std::make_unique<Chunk>();
+    Chunk* last = first.get(); // only accessed by the owning thread
+
+    ~ThreadBuffer()
+    {
+        // The chunks after the first are owned through the raw next pointers:
+        Chunk* chunk = first->next;
+        while (chunk)
+        {
+            Chunk* next = chunk->next;
+            delete chunk;
+            chunk = next;
+        }
+    };
+};
+
+struct State
+{
+    std::atomic<bool> enabled{false};
+    clock::time_point start;
+    std::mutex mutex; // guards buffers and names
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers; // of all threads that have recorded, in order
+    std::deque<std::string> names; // the interned names, which a deque never moves
+};
+
+inline State& get_state()
+{
+    static State state;
+    return state;
+};
+
+inline const char*& get_thread_name()
+{
+    thread_local const char* thread_name = nullptr;
+    return thread_name;
+};
+
+inline ThreadBuffer& get_thread_buffer()
+{
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (!buffer)
+    {
+        auto& state = get_state();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.buffers.push_back(std::make_unique<ThreadBuffer>());
+        buffer = state.buffers.back().get();
+        buffer->thread_id = static_cast<int>(state.buffers.size());
+        buffer->thread_name = get_thread_name();
+    }
+    return *buffer;
+};
+
+// Writes a string as JSON string, with the characters that JSON doesn't allow in strings escaped:
+inline void write_json_string(std::ostream& stream, const char* string)
+{
+    stream << '"';
+    for (const char* c = string; *c != '\0'; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            stream << '\\' << *c;
+        } else if (static_cast<unsigned char>(*c) < 0x20)
+        {
+            stream << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(*c)
+                   << std::dec << std::setfill(' ');
+        } else
+        {
+            stream << *c;
+        }
+    }
+    stream << '"';
+};
+
+} /* namespace detail */
+
+/**
+ * Starts recording spans. The times in the trace are relative to this call. Call it before the threads
+ * whose spans should be recorded start, so that their names are known.
+ */
+inline void enable()
+{
+    auto& state = detail::get_state();
+    state.start = clock::now();
+    state.enabled.store(true, std::memory_order_release);
+};
+
+inline bool is_enabled()
+{
+    return detail::get_state().enabled.load(std::memory_order_relaxed);
+};
+
+/**
+ * Copies a name into the trace, for spans whose names are not string literals.
+ *
+ * @param[in] name The name.
+ * @return The copy, which lives as long as the trace.
+ */
+inline const char* intern(const std::string& name)
+{
+    auto& state = detail::get_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.names.push_back(name);
+    return state.names.back().c_str();
+};
+
+/**
+ * Sets the name the calling thread is shown with in the trace.
+ *
+ * @param[in] name The name. Not copied, so it has to be a string literal or outlive the trace.
+ */
+inline void set_thread_name(const char* name)
+{
+    detail::get_thread_name() = name;
+    if (is_enabled())
+    {
+        detail::get_thread_buffer().thread_name.store(name, std::memory_order_release);
+    }
+};
+
+/**
+ * Records a span of the calling thread, if tracing is enabled.
+ *
+ * @param[in] name The name of the span. Not copied, so it has to be a string literal or interned.
+ * @param[in] start When the span started.
+ * @param[in] end When the span ended.
+ */
+inline void add_span(const char* name, clock::time_point start, clock::time_point end)
+{
+    if (!is_enabled())
+    {
+        return;
+    }
+    auto& buffer = detail::get_thread_buffer();
+    auto num_events = buffer.last->num_events.load(std::memory_order_relaxed);
+    if (num_events == detail::Chunk::capacity)
+    {
+        auto* chunk = new detail::Chunk();
+        buffer.last->next.store(chunk, std::memory_order_release);
+        buffer.last = chunk;
+        num_events = 0;
+    }
+    buffer.last->events[num_events] = {name, start, end};
+    // Publishes the event to write_chrome_trace():
+    buffer.last->num_events.store(num_events + 1, std::memory_order_release);
+};
+
+/**
+ * Records the time from its construction to its destruction as a span of the calling thread, if tracing
+ * is enabled.
+ */
+class Span
+{
+public:
+    explicit Span(const char* name) : name(name), start(is_enabled() ? clock::now() : clock::time_point()){};
+
+    ~Span()
+    {
+        if (start != clock::time_point())
+        {
+            add_span(name, start, clock::now());
+        }
+    };
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    const char* name;
+    clock::time_point start;
+};
+
+/**
+ * Writes all spans that have been recorded so far as Chrome trace JSON, in the "JSON object format",
+ * with one complete event ("ph": "X") per span, and the names of the threads as metadata. The threads
+ * may keep recording while this runs, their new spans are just not written.
+ *
+ * @param[in] filename The file to write.
+ * @throw std::runtime_error if the file can't be written.
+ */
+inline void write_chrome_trace(const std::string& filename)
+{
+    std::ofstream file(filename);
+    if (!file)
+    {
+        throw std::runtime_error("Error opening file for writing: " + filename);
+    }
+    auto& state = detail::get_state();
+    const auto to_microseconds = [](clock::duration duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    };
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    file << std::fixed << std::setprecision(3);
+    bool is_first_event = true;
+    const auto begin_event = [&]() {
+        file << (is_first_event ? "\n" : ",\n");
+        is_first_event = false;
+    };
+    std::lock_guard<std::mutex> lock(state.mutex);
+    for (const auto& buffer : state.buffers)
+    {
+        const char* thread_name = buffer->thread_name.load(std::memory_order_acquire);
+        if (thread_name)
+        {
+            begin_event();
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_id
+                 << ",\"args\":{\"name\":";
+            detail::write_json_string(file, thread_name);
+            file << "}}";
+        }
+        for (const detail::Chunk* chunk = buffer->first.get(); chunk;
+             chunk = chunk->next.load(std::memory_order_acquire))
+        {
+            const auto num_events = chunk->num_events.load(std::memory_order_acquire);
+            for (std::size_t i = 0; i < num_events; ++i)
+            {
+                const auto& event = chunk->events[i];
+                begin_event();
+                file << "{\"name\":";
+                detail::write_json_string(file, event.name);
+                file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+                     << ",\"ts\":" << to_microseconds(event.start - state.start)
+                     << ",\"dur\":" << to_microseconds(event.end - event.start) << "}";
+            }
+        }
+    }
+    file << "\n]}\n";
+    if (!file)
+    {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+};
+
+/**
+ * Enables tracing when it's constructed, and writes the trace to a file when it's destroyed. Declared at
+ * the start of main(), it's destroyed after everything else, so the spans of all threads are complete.
+ * Does nothing if no file is given.
+ */
+class Session
+{
+public:
+    /**
+     * @param[in] filename The file to write the trace to, or an empty string to not trace.
+     * @param[in] log Where to report that the trace has been written, or why it couldn't be.
+     */
+    Session(std::string filename, std::ostream& log) : filename(std::move(filename)), log(log)
+    {
+        if (!this->filename.empty())
+        {
+            enable();
+        }
+    };
+
+    ~Session()
+    {
+        if (filename.empty())
+        {
+            return;
+        }
+        try
+        {
+            write_chrome_trace(filename);
+            log << "Wrote the trace to " << filename << "." << std::endl;
+        } catch (const std::runtime_error& e)
+        {
+            log << "Error writing the trace: " << e.what() << std::endl;
+        }
+    };
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+private:
+    std::string filename;
+    std::ostream& log;
+};
+
+} /* namespace trace */
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_TRACE_HPP */
@@ -0,0 +1,115 @@
+/*
+ * eos - A 3D Morphable Model fitting library written in modern C++11/14.
+ *
+ * File: viewer_buffers.hpp
+ *
+ * Copyright 2018 Patrik Huber
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#ifndef EOSVIEWER_VIEWER_BUFFERS_HPP
+#define EOSVIEWER_VIEWER_BUFFERS_HPP
+
+#include "ModelView.hpp"
+
+#include "Eigen/Core"
+
+#include <cstddef>
+
+namespace eosviewer {
+
+/**
+ * Writes a model instance, stored as x_0, y_0, z_0, x_1, ... (or r, g, b), into the given
+ * N x 3 matrix, which is the layout the libigl viewer uses for vertices and colours.
+ *
+ * The conversion to double and the reshape happen in a single pass, without any temporaries.
+ * The buffer is only re-allocated if its size doesn't match, so if it is kept around (or it is
+ * the viewer's own buffer), the steady-state path does not allocate.
+ *
+ * @param[in] instance A shape or colour instance with 3 * N elements.
+ * @param[in,out] buffer The N x 3 buffer to write into.
+ * @return The number of bytes written.
+ */
+inline std::size_t copy_to_viewer_layout(const Eigen::Ref<const Eigen::VectorXf>& instance,
+                                         Eigen::MatrixXd& buffer)
+{
+    using RowMajorMatrixX3f = Eigen::Matrix<float, Eigen::Dynamic, 3, Eigen::RowMajor>;
+    const auto num_vertices = instance.rows() / 3;
+    if (buffer.rows() != num_vertices || buffer.cols() != 3)
+    {
+        buffer.resize(num_vertices, 3);
+    }
+    buffer = Eigen::Map<const RowMajorMatrixX3f>(instance.data(), num_vertices, 3).cast<double>();
+    return static_cast<std::size_t>(buffer.size()) * sizeof(double);
+};
+
+/**
+ * Writes a colour instance, stored as r_0, g_0, b_0, r_1, ..., directly into the per-vertex
+ * material buffers of a libigl ViewerData, in place.
+ *
+ * This computes the same as ViewerData::set_colors() does for per-vertex colours, which is
+ * diffuse = (r, g, b, 1), ambient = 0.1 * diffuse and specular = 0.3 + 0.1 * (diffuse - 0.3),
+ * with the alpha of diffuse. set_colors() however builds the ambient and specular colours as
+ * temporaries on every call. The buffers have to have been set up by a call to set_colors()
+ * (with one colour per vertex) before. The caller has to mark the buffers as dirty.
+ *
+ * @param[in] instance A colour instance with 3 * N elements.
+ * @param[in,out] diffuse The viewer's N x 4 diffuse material buffer.
+ * @param[in,out] ambient The viewer's N x 4 ambient material buffer.
+ * @param[in,out] specular The viewer's N x 4 specular material buffer.
+ * @return The number of bytes written, or 0 if the buffers don't have the right size, in which
+ *         case nothing is written.
+ */
+inline std::size_t write_viewer_colors(const Eigen::VectorXf& instance, Eigen::MatrixXd& diffuse,
+                                       Eigen::MatrixXd& ambient, Eigen::MatrixXd& specular)
+{
+    const auto num_vertices = instance.rows() / 3;
+    if (diffuse.rows() != num_vertices || diffuse.cols() != 4 || ambient.rows() != num_vertices ||
+        ambient.cols() != 4 || specular.rows() != num_vertices || specular.cols() != 4)
+    {
+        return 0;
+    }
+    const double grey = 0.3;
+    for (Eigen::Index i = 0; i < num_vertices; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            const double value = instance(3 * i + c);
+            diffuse(i, c) = value;
+            ambient(i, c) = 0.1 * value;
+            specular(i, c) = grey + 0.1 * (value - grey);
+        }
+        diffuse(i, 3) = 1.0;
+        ambient(i, 3) = 1.0;
+        specular(i, 3) = 1.0;
+    }
+    return 3 * static_cast<std::size_t>(diffuse.size()) * sizeof(double);
+};
+
+/**
+ * Converts the triangles of a model, as a row-major F x 3 matrix (see ModelView), to the
+ * column-major F x 3 face matrix that the libigl viewer expects.
+ *
+ * @param[in] triangles The triangles, each given by three vertex indices.
+ * @return The faces as F x 3 matrix.
+ */
+inline Eigen::MatrixXi to_viewer_faces(const ConstTriangleMap& triangles)
+{
+    return Eigen::MatrixXi(triangles);
+};
+
+} /* namespace eosviewer */
+
+#endif /* EOSVIEWER_VIEWER_BUFFERS_HPP */